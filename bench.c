@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "circuit.h"
+#include "weave.h"
+#include "world.h"
+
+/* Benchmarks. Times full testreps passes of the compiled-in task over a
+ * frozen corpus of evolved genomes using the compiled-in event queue (see
+ * evq.h). Build once per backend and compare the evps columns.
+ *
+ * The corpus is read from the path given on the command line (default
+ * CORPUS). If it does not exist, a small population is evolved from a
+ * fixed seed and written there; the corpus has to be shared between
+ * backends, since evolving under each one would bench different genomes.
+ *
+ * Every energy is timed two ways: one genome at a time (bench=run), and
+ * WEAVESLOTS genomes interleaved on one thread (bench=weave). Genomes that
+ * can never complete (see circdead()) are scored without simulating, as
+ * runtask() does, so both time and count the same genomes.
+ *
+ * Microbenchmarks then time the pieces underneath: the event queue held at
+ * a fixed depth (bench=queue), the generators (bench=ru, bench=rf), genome
+ * mutation, hashing and analysis (bench=mutcirc, bench=hashcirc,
+ * bench=reachcirc) and single episodes over the corpus (bench=episode).
+ * Last, whole generations of the real evolution loop (see world.h) are
+ * timed at several population sizes and genome lengths (bench=gen). A
+ * random world rarely has a survivor, and until one turns up every
+ * generation only evaluates and regenerates, so the untimed warmup runs
+ * until a generation ends with circuits alive. fed counts the timed
+ * generations that fed and reproduced; fed=0 means the line timed
+ * evaluation and regeneration only.
+ *
+ * Everything is seeded from SEED. Every result is one line of key=value
+ * pairs, starting with bench=. */
+
+#define SEED (0x5eedLU)
+
+#define BPOP (256)
+#define BCIRCLN (40)
+#define BGENS (16)
+
+/* Energy while evolving the corpus */
+#define BEVENERG (5000)
+
+#define BEVMUT (0.3f)
+
+/* Microbenchmark operations per timing */
+#define BOPS (1LU << 22)
+/* Queue depths for bench=queue: a short episode, a long one, a runaway */
+#define BQDEPTHS { 16, 256, 4096 }
+
+/* Generations timed per setting for bench=gen, after at most BGENWARM
+ * untimed ones waiting for a survivor */
+#define BGENRUN (4)
+#define BGENWARM (256)
+#define BGENSETS { { 256, 40 }, { 1024, 40 }, { 4096, 40 }, { 1024, 20 } }
+
+#ifndef CORPUS
+#define CORPUS "corpus.bin"
+#endif
+
+/* Corpus file: magic, genome count, genome length, then the code words */
+#define CORPMAGIC (0x3150524f43564545LU)
+
+/* Keeps timed results alive */
+volatile u64 sink;
+
+f64 now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int cmpdefects(const void* a, const void* b) {
+    const circ* x = *(const circ**) a;
+    const circ* y = *(const circ**) b;
+    return (x->defects > y->defects) - (x->defects < y->defects);
+}
+
+/* Truncation selection: the better half replaces the worse half with
+ * mutated clones every generation. */
+void evolve(u64* rstate, evq* h, simbuf* sb, circ** pop) {
+    for (u64 g = 0; g < BGENS; ++g) {
+        for (u64 i = 0; i < BPOP; ++i) {
+            u64 tstate[4];
+            memcpy(tstate, rstate, sizeof(u64) * 4);
+            pop[i]->energy = BEVENERG;
+            run(h, tstate, pop[i], sb);
+        }
+        qsort(pop, BPOP, sizeof(circ*), cmpdefects);
+        for (u64 i = BPOP / 2; i < BPOP; ++i) {
+            repcirc(pop[i], pop[i - BPOP / 2]);
+            mutcirc(rstate, pop[i], BEVMUT, BEVMUT);
+        }
+        ru(rstate);
+    }
+}
+
+/* Genomes of pop that need simulating */
+u64 benchlive(circ** pop) {
+    u64 n = 0;
+    for (u64 i = 0; i < BPOP; ++i) n += !circdead(pop[i], NULL);
+    return n;
+}
+
+/* Time every genome through testreps passes starting from energy. Events
+ * are counted as energy spent. */
+void benchrun(u64* rstate, evq* h, simbuf* sb, circ** pop, u64 energy) {
+    u64 events = 0;
+    f64 start = now();
+    for (u64 i = 0; i < BPOP; ++i) {
+        if (circdead(pop[i], NULL)) continue;
+        u64 tstate[4];
+        memcpy(tstate, rstate, sizeof(u64) * 4);
+        pop[i]->energy = energy;
+        for (u64 r = 0; r < conf.testreps; ++r) {
+            u64 e0 = pop[i]->energy;
+            runpass(h, sb, pop[i], tstate, NULL);
+            events += e0 - pop[i]->energy;
+        }
+    }
+    f64 secs = now() - start;
+
+    printf("bench=run queue=%s energy=%lu genomes=%lu events=%lu secs=%.6f evps=%.0f\n",
+           EVQNAME, energy, benchlive(pop), events, secs, events / secs);
+}
+
+/* benchrun() with the whole corpus interleaved */
+void benchweave(u64* rstate, weave* W, circ** pop, i64* res, u64 energy) {
+    for (u64 i = 0; i < BPOP; ++i) pop[i]->energy = energy;
+    W->events = 0;
+    f64 start = now();
+    runweave(W, rstate, pop, BPOP, NULL, NOCUT, 0, res);
+    f64 secs = now() - start;
+
+    printf("bench=weave queue=%s slots=%d energy=%lu genomes=%lu events=%lu secs=%.6f evps=%.0f\n",
+           EVQNAME, WEAVESLOTS, energy, benchlive(pop), W->events, secs, W->events / secs);
+}
+
+/* The queue held at depth: every step pops two events and pushes two, as a
+ * gate does. Reported per event popped. */
+void benchqueue(u64 depth) {
+    u64 rstate[4];
+    seedr(rstate, SEED);
+    evq* q = initevq();
+    for (u64 i = 0; i < depth; ++i) {
+        evqins(q, conf.mindel + rf(rstate) * (conf.maxdel - conf.mindel), i, 1.f);
+    }
+
+    f64 start = now();
+    for (u64 k = 0; k < BOPS / 2; ++k) {
+        f32 t1, t2, v;
+        u32 i1, i2;
+        evqrem(q, &t1, &i1, &v);
+        evqrem(q, &t2, &i2, &v);
+        evqins2(q, t2 + conf.mindel + rf(rstate) * (conf.maxdel - conf.mindel), i1,
+                t2 + conf.mindel + rf(rstate) * (conf.maxdel - conf.mindel), i2, v);
+    }
+    f64 secs = now() - start;
+    sink = evqlen(q);
+    freeevq(q);
+
+    printf("bench=queue queue=%s depth=%lu ops=%lu secs=%.6f nsop=%.3f\n",
+           EVQNAME, depth, BOPS, secs, secs * 1e9 / BOPS);
+}
+
+void benchrand() {
+    u64 rstate[4];
+    seedr(rstate, SEED);
+    u64 acc = 0;
+    f64 start = now();
+    for (u64 k = 0; k < BOPS; ++k) acc += ru(rstate);
+    f64 secs = now() - start;
+    sink = acc;
+    printf("bench=ru ops=%lu secs=%.6f nsop=%.3f\n", BOPS, secs, secs * 1e9 / BOPS);
+
+    f32 facc = 0.f;
+    start = now();
+    for (u64 k = 0; k < BOPS; ++k) facc += rf(rstate);
+    secs = now() - start;
+    sink = (u64) facc;
+    printf("bench=rf ops=%lu secs=%.6f nsop=%.3f\n", BOPS, secs, secs * 1e9 / BOPS);
+}
+
+/* Mutation, hashing and static analysis of scratch copies of the corpus */
+void benchgenome(circ** pop) {
+    u64 rstate[4];
+    seedr(rstate, SEED);
+    circ* c = initcirc(BCIRCLN);
+    u64 ops = BOPS / BCIRCLN;
+
+    f64 start = now();
+    for (u64 k = 0; k < ops; ++k) {
+        if (k % BPOP == 0) repcirc(c, pop[(k / BPOP) % BPOP]);
+        mutcirc(rstate, c, conf.tmut, conf.bmut);
+    }
+    f64 secs = now() - start;
+    printf("bench=mutcirc clen=%d ops=%lu secs=%.6f nsop=%.3f\n", BCIRCLN, ops, secs, secs * 1e9 / ops);
+
+    u64 acc = 0;
+    start = now();
+    for (u64 k = 0; k < ops; ++k) {
+        hashcirc(pop[k % BPOP]);
+        acc += pop[k % BPOP]->hash;
+    }
+    secs = now() - start;
+    sink = acc;
+    printf("bench=hashcirc clen=%d ops=%lu secs=%.6f nsop=%.3f\n", BCIRCLN, ops, secs, secs * 1e9 / ops);
+
+    u64 dead = 0;
+    start = now();
+    for (u64 k = 0; k < ops; ++k) {
+        reachcirc(pop[k % BPOP]);
+        acc += pop[k % BPOP]->epev;
+        dead += circdead(pop[k % BPOP], NULL);
+    }
+    secs = now() - start;
+    sink = acc;
+    printf("bench=reachcirc clen=%d ops=%lu secs=%.6f nsop=%.3f dead=%f\n", BCIRCLN, ops, secs, secs * 1e9 / ops,
+           dead / ((f64) ops));
+
+    free(c->code);
+    free(c->repcode);
+    free(c);
+}
+
+/* One episode on the first row of the compiled-in task at a time, with a
+ * newborn's energy */
+void benchepisode(evq* h, simbuf* sb, circ** pop) {
+    u64 rstate[4];
+    seedr(rstate, SEED);
+    const taskrow* r = &taskfixed.rows[0];
+    u64 ops = BOPS / 64;
+    u64 events = 0;
+
+    f64 start = now();
+    for (u64 k = 0; k < ops; ++k) {
+        circ* c = pop[k % BPOP];
+        c->energy = conf.initenerg;
+        episode(h, sb, c, rstate, r);
+        events += conf.initenerg - c->energy;
+    }
+    f64 secs = now() - start;
+
+    printf("bench=episode queue=%s energy=%lu ops=%lu events=%lu secs=%.6f nsop=%.3f evps=%.0f\n",
+           EVQNAME, conf.initenerg, ops, events, secs, secs * 1e9 / ops, events / secs);
+}
+
+/* Whole generations of a fresh world of pop circuits of clen nodes */
+void benchgen(evpool* wp, u64 pop, u64 clen) {
+    world* w = initworld(pop, clen, SEED, wp, NULL);
+    genrec g;
+    u64 warm = 0;
+    while (warm < BGENWARM && genstep(w, &g) == GENREGEN) warm++;
+
+    u64 events = 0;
+    u64 regen = 0;
+    f64 start = now();
+    for (u64 k = 0; k < BGENRUN; ++k) {
+        if (genstep(w, &g) == GENREGEN) regen++;
+        events += w->ec->events;
+    }
+    f64 secs = now() - start;
+
+    printf("bench=gen queue=%s threads=%lu pop=%lu clen=%lu warm=%lu gens=%d fed=%lu events=%lu secs=%.6f gps=%.3f evps=%.0f\n",
+           EVQNAME, wp->nw, pop, clen, warm, BGENRUN, BGENRUN - regen, events, secs, BGENRUN / secs, events / secs);
+    freeworld(w);
+}
+
+int loadcorpus(const char* path, circ** pop) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    u64 hdr[3];
+    if (fread(hdr, sizeof(u64), 3, f) != 3 || hdr[0] != CORPMAGIC ||
+        hdr[1] != BPOP || hdr[2] != pop[0]->clen) {
+        printf("Bad corpus %s\n", path);
+        exit(-1);
+    }
+    for (u64 i = 0; i < BPOP; ++i) {
+        if (fread(pop[i]->code, sizeof(u64), pop[i]->clen, f) != pop[i]->clen) {
+            printf("Truncated corpus %s\n", path);
+            exit(-1);
+        }
+        hashcirc(pop[i]);
+        reachcirc(pop[i]);
+    }
+    fclose(f);
+
+    return 0;
+}
+
+void savecorpus(const char* path, circ** pop) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        printf("Failed to write corpus %s\n", path);
+        exit(-1);
+    }
+
+    u64 hdr[3] = { CORPMAGIC, BPOP, pop[0]->clen };
+    fwrite(hdr, sizeof(u64), 3, f);
+    for (u64 i = 0; i < BPOP; ++i) {
+        fwrite(pop[i]->code, sizeof(u64), pop[i]->clen, f);
+    }
+    fclose(f);
+}
+
+int main(int argc, char** argv) {
+    const char* corpus = (argc > 1) ? argv[1] : CORPUS;
+
+    u64 rstate[4];
+    seedr(rstate, SEED);
+
+    circ** pop = (circ**) malloc(sizeof(circ*) * BPOP);
+    if (pop == NULL) {
+        printf("Failed to allocate population array.\n");
+        return -1;
+    }
+    for (u64 i = 0; i < BPOP; ++i) {
+        pop[i] = initcirc(BCIRCLN);
+        randcirc(rstate, pop[i]);
+    }
+
+    evq* h = initevq();
+    simbuf* sb = initsimbuf(BCIRCLN + 5);
+    weave* W = initweave(BCIRCLN + 5);
+    i64* res = (i64*) malloc(sizeof(i64) * BPOP);
+    if (res == NULL) {
+        printf("Failed to allocate result array.\n");
+        return -1;
+    }
+
+    if (loadcorpus(corpus, pop) != 0) {
+        evolve(rstate, h, sb, pop);
+        savecorpus(corpus, pop);
+    }
+
+    /* A newborn's budget, and one large enough to run most episodes dry */
+    benchrun(rstate, h, sb, pop, 800);
+    benchweave(rstate, W, pop, res, 800);
+    benchrun(rstate, h, sb, pop, 100000);
+    benchweave(rstate, W, pop, res, 100000);
+
+    u64 depths[] = BQDEPTHS;
+    for (u64 k = 0; k < sizeof(depths) / sizeof(u64); ++k) benchqueue(depths[k]);
+    benchrand();
+    benchgenome(pop);
+    benchepisode(h, sb, pop);
+
+    u64 sets[][2] = BGENSETS;
+    u64 maxlen = 0;
+    for (u64 k = 0; k < sizeof(sets) / sizeof(sets[0]); ++k) {
+        if (sets[k][1] > maxlen) maxlen = sets[k][1];
+    }
+    evpool* wp = initpool(0, maxlen + 5);
+    for (u64 k = 0; k < sizeof(sets) / sizeof(sets[0]); ++k) benchgen(wp, sets[k][0], sets[k][1]);
+    freepool(wp);
+
+    for (u64 i = 0; i < BPOP; ++i) {
+        free(pop[i]->code);
+        free(pop[i]->repcode);
+        free(pop[i]);
+    }
+    free(pop);
+    freeevq(h);
+    freesimbuf(sb);
+    freeweave(W);
+    free(res);
+    return 0;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "types.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Calendar queue (timing wheel) for event times that only move forward and
+ * are scheduled a bounded delay [mindel, maxdel] ahead of the current time.
+ *
+ * Buckets are mindel wide, and there are enough of them to cover maxdel. An
+ * event popped from bucket k schedules its successors at least mindel later,
+ * so they land in k + 1 or beyond: the current bucket never grows while it
+ * is being drained. Inserting is an append to an unsorted bucket. A bucket
+ * is sorted once, when the wheel reaches it, and then read front to back. */
+
+/* Buckets up to this size are insertion sorted, larger ones radix sorted */
+#define CQSMALL (32)
+#define CQRADIX (11)
+
+typedef struct {
+    f32 t;
+    u32 ind;
+    f32 v;
+} cqev;
+
+typedef struct {
+    cqev* evs;
+    u64 n;
+    u64 cap;
+} cqbucket;
+
+typedef struct {
+    cqbucket* b;
+    u64 nb;
+    u64 mask;
+    f32 iw;
+
+    /* Absolute index of the current bucket. Once sorted, its events before
+     * head have been popped. */
+    u64 cur;
+    u64 sorted;
+    u64 head;
+    u64 n;
+
+    /* Radix sort scratch */
+    cqbucket tmp;
+    u32 cnt[1U << CQRADIX];
+} calq;
+
+void cqgrow(cqbucket* b, u64 cap) {
+    if (cap <= b->cap) return;
+    while (b->cap < cap) b->cap *= 2;
+    b->evs = (cqev*) realloc(b->evs, sizeof(cqev) * b->cap);
+    if (b->evs == NULL) {
+        printf("Failed to realloc calendar bucket.\n");
+        exit(-1);
+    }
+}
+
+calq* initcalq(f32 mindel, f32 maxdel) {
+    calq* out = (calq*) malloc(sizeof(calq));
+    if (out == NULL) {
+        printf("Failed to init calendar queue.\n");
+        exit(-1);
+    }
+
+    /* Current bucket, a full maxdel ahead, and one for rounding */
+    u64 need = ((u64) (maxdel / mindel)) + 2;
+    out->nb = 1;
+    while (out->nb < need) out->nb <<= 1;
+    out->mask = out->nb - 1;
+    out->iw = 1.f / mindel;
+    out->cur = 0;
+    out->sorted = 0;
+    out->head = 0;
+    out->n = 0;
+
+    out->b = (cqbucket*) malloc(sizeof(cqbucket) * out->nb);
+    if (out->b == NULL) {
+        printf("Failed to init calendar queue.\n");
+        exit(-1);
+    }
+    for (u64 i = 0; i <= out->nb; ++i) {
+        cqbucket* b = (i < out->nb) ? &out->b[i] : &out->tmp;
+        b->n = 0;
+        b->cap = 16;
+        b->evs = (cqev*) malloc(sizeof(cqev) * b->cap);
+        if (b->evs == NULL) {
+            printf("Failed to init calendar queue.\n");
+            exit(-1);
+        }
+    }
+
+    return out;
+}
+
+void freecalq(calq* q) {
+    for (u64 i = 0; i < q->nb; ++i) free(q->b[i].evs);
+    free(q->tmp.evs);
+    free(q->b);
+    free(q);
+}
+
+static inline u32 cqkey(f32 t) {
+    /* Times are non-negative, so their bit patterns sort like the values */
+    u32 k;
+    memcpy(&k, &t, sizeof(u32));
+    return k;
+}
+
+/* Sort a bucket ascending by time */
+void cqsort(calq* q, cqbucket* b) {
+    if (b->n <= CQSMALL) {
+        for (u64 i = 1; i < b->n; ++i) {
+            cqev e = b->evs[i];
+            u64 j = i;
+            while (j > 0 && b->evs[j - 1].t > e.t) {
+                b->evs[j] = b->evs[j - 1];
+                j--;
+            }
+            b->evs[j] = e;
+        }
+        return;
+    }
+
+    /* LSD radix sort on the time bits. Every event in a bucket shares its
+     * exponent and top mantissa bits, so the high digit is usually skipped. */
+    u32 msk = (1U << CQRADIX) - 1U;
+    cqgrow(&q->tmp, b->n);
+    for (u32 sh = 0; sh < 32; sh += CQRADIX) {
+        memset(q->cnt, 0, sizeof(q->cnt));
+        for (u64 i = 0; i < b->n; ++i) q->cnt[(cqkey(b->evs[i].t) >> sh) & msk]++;
+        if (q->cnt[(cqkey(b->evs[0].t) >> sh) & msk] == b->n) continue;
+
+        u32 sum = 0;
+        for (u32 d = 0; d <= msk; ++d) {
+            u32 c = q->cnt[d];
+            q->cnt[d] = sum;
+            sum += c;
+        }
+        for (u64 i = 0; i < b->n; ++i) {
+            q->tmp.evs[q->cnt[(cqkey(b->evs[i].t) >> sh) & msk]++] = b->evs[i];
+        }
+
+        cqev* sw = b->evs;
+        u64 swcap = b->cap;
+        b->evs = q->tmp.evs;
+        b->cap = q->tmp.cap;
+        q->tmp.evs = sw;
+        q->tmp.cap = swcap;
+    }
+}
+
+void cqins(calq* q, f32 it, u32 iind, f32 v) {
+    u64 k = (u64) (it * q->iw);
+    /* Rounding can put an event a hair before the current bucket */
+    if (k < q->cur) k = q->cur;
+    if (k - q->cur >= q->nb) {
+        printf("Calendar queue delay out of range.\n");
+        exit(-1);
+    }
+
+    cqbucket* b = &q->b[k & q->mask];
+    cqgrow(b, b->n + 1);
+
+    u64 i = b->n;
+    if (k == q->cur && q->sorted) {
+        /* Delay under a bucket width. Keep the current bucket sorted. */
+        while (i > q->head && b->evs[i - 1].t > it) {
+            b->evs[i] = b->evs[i - 1];
+            i--;
+        }
+    }
+    b->evs[i].t = it;
+    b->evs[i].ind = iind;
+    b->evs[i].v = v;
+    b->n++;
+    q->n++;
+}
+
+int cqrem(calq* q, f32* ot, u32* oind, f32* v) {
+    if (q->n == 0) {
+        return -1;
+    }
+
+    cqbucket* b = &q->b[q->cur & q->mask];
+    if (q->sorted && q->head == b->n) {
+        /* Current bucket drained */
+        b->n = 0;
+        q->head = 0;
+        q->sorted = 0;
+        q->cur++;
+        b = &q->b[q->cur & q->mask];
+    }
+    while (b->n == 0) {
+        q->cur++;
+        b = &q->b[q->cur & q->mask];
+    }
+
+    if (!q->sorted) {
+        cqsort(q, b);
+        q->sorted = 1;
+        q->head = 0;
+    }
+
+    cqev* e = &b->evs[q->head++];
+    *ot = e->t;
+    *oind = e->ind;
+    *v = e->v;
+    q->n--;
+
+    return 0;
+}
+
+void cqclear(calq* q) {
+    for (u64 i = 0; i < q->nb; ++i) q->b[i].n = 0;
+    q->cur = 0;
+    q->sorted = 0;
+    q->head = 0;
+    q->n = 0;
+}
+
+/* Warm the next event of the current bucket */
+static inline void cqprefetch(const calq* q) {
+    const cqbucket* b = &q->b[q->cur & q->mask];
+    if (q->sorted && q->head < b->n) __builtin_prefetch(&b->evs[q->head]);
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "types.h"
+#include "circuit.h"
+#include "slab.h"
+#include "surrogate.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Population checkpoints.
+ *
+ * A checkpoint holds everything the next generation starts from: every
+ * circuit's header fields and genome, the seed, the iteration count, the
+ * early abort cut and the surrogate model. The layout mirrors the
+ * population slab so a resume is a few straight copies out of a read-only
+ * mapping:
+ *
+ *   ckhead, padded to CKHEADSZ
+ *   ckcirc[n], padded to 64 bytes
+ *   code slab, n * stride words
+ *   repcode slab, n * stride words
+ *
+ * All words are native endian. Files are written to path.tmp and renamed
+ * over path once complete, so a crash never leaves a torn checkpoint.
+ *
+ * cksnap() writes from a fork()ed child: the child gets a copy-on-write
+ * image of the population at the moment of the call, and the parent goes
+ * straight back to evolving. One snapshot is in flight at a time; a
+ * snapshot due while the last one is still writing is skipped. */
+
+#define CKMAGIC (0x54504b4349564f45LU)
+#define CKVERSION (2)
+#define CKHEADSZ (4096)
+
+typedef struct {
+    u64 iters;
+    u64 seed;
+    u64 cut;
+    surr sg;
+} ckstate;
+
+typedef struct {
+    u64 magic;
+    u64 version;
+    u64 n;
+    u64 clen;
+    u64 stride;
+    /* Byte offsets of the sections, and the file size */
+    u64 circoff;
+    u64 codeoff;
+    u64 repoff;
+    u64 size;
+    ckstate st;
+} ckhead;
+
+typedef struct {
+    u64 energy;
+    u64 hash;
+    u64 defects;
+    u64 zeros;
+    u64 born;
+    u64 spent;
+    u64 reps;
+    f64 rate;
+    u64 rated;
+} ckcirc;
+
+/* A background writer */
+typedef struct {
+    char path[4096];
+    pid_t pid;
+    u64 written;
+    u64 skipped;
+} ckpt;
+
+static void cklayout(ckhead* h, const slab* S) {
+    memset(h, 0, sizeof(ckhead));
+    h->magic = CKMAGIC;
+    h->version = CKVERSION;
+    h->n = S->n;
+    h->clen = S->clen;
+    h->stride = S->stride;
+    h->circoff = CKHEADSZ;
+    h->codeoff = (h->circoff + sizeof(ckcirc) * S->n + 63) & ~63LU;
+    h->repoff = h->codeoff + sizeof(u64) * S->n * S->stride;
+    h->size = h->repoff + sizeof(u64) * S->n * S->stride;
+}
+
+static int ckputs(int fd, const void* buf, u64 len) {
+    const char* p = (const char*) buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* Write the checkpoint body to fd. Touches no heap, so it is safe in a
+ * child forked from a threaded parent. */
+static int ckbody(int fd, const slab* S, const ckstate* st) {
+    static const u8 zero[CKHEADSZ];
+    ckhead h;
+    cklayout(&h, S);
+    h.st = *st;
+
+    if (ckputs(fd, &h, sizeof(h)) != 0) return -1;
+    if (ckputs(fd, zero, h.circoff - sizeof(h)) != 0) return -1;
+
+    ckcirc buf[64];
+    for (u64 i = 0; i < S->n; i += 64) {
+        u64 k = (S->n - i < 64) ? S->n - i : 64;
+        for (u64 j = 0; j < k; ++j) {
+            const circ* c = &S->circs[i + j];
+            buf[j] = (ckcirc) { c->energy, c->hash, c->defects, c->zeros, c->born,
+                                c->spent, c->reps, c->rate, c->rated };
+        }
+        if (ckputs(fd, buf, sizeof(ckcirc) * k) != 0) return -1;
+    }
+    if (ckputs(fd, zero, h.codeoff - h.circoff - sizeof(ckcirc) * S->n) != 0) return -1;
+
+    if (ckputs(fd, S->code, sizeof(u64) * S->n * S->stride) != 0) return -1;
+    if (ckputs(fd, S->repcode, sizeof(u64) * S->n * S->stride) != 0) return -1;
+    return 0;
+}
+
+/* Write a checkpoint of S and st to path. Returns 0 on success. */
+int cksave(const char* path, const slab* S, const ckstate* st) {
+    char tmp[4096 + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (ckbody(fd, S, st) != 0 || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void initckpt(ckpt* k, const char* path) {
+    snprintf(k->path, sizeof(k->path), "%s", path);
+    k->pid = 0;
+    k->written = 0;
+    k->skipped = 0;
+}
+
+/* Reap the writer in flight. With block unset, only if it already exited.
+ * Returns 1 while a writer is still running. */
+int ckreap(ckpt* k, int block) {
+    if (k->pid == 0) return 0;
+    int status;
+    pid_t r = waitpid(k->pid, &status, block ? 0 : WNOHANG);
+    if (r == 0) return 1;
+    if (r == k->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        k->written++;
+    } else {
+        printf("Checkpoint to %s failed.\n", k->path);
+    }
+    k->pid = 0;
+    return 0;
+}
+
+/* Snapshot S and st in the background */
+void cksnap(ckpt* k, const slab* S, const ckstate* st) {
+    if (ckreap(k, 0)) {
+        k->skipped++;
+        return;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("Failed to fork checkpoint writer.\n");
+        exit(-1);
+    }
+    if (pid == 0) {
+        _exit(cksave(k->path, S, st) == 0 ? 0 : 1);
+    }
+    k->pid = pid;
+}
+
+/* Restore S and st from the checkpoint at path. S must have been built with
+ * the same size and circuit length. */
+void ckload(const char* path, slab* S, ckstate* st) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open checkpoint %s.\n", path);
+        exit(-1);
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (u64) sb.st_size < CKHEADSZ) {
+        printf("Checkpoint %s is truncated.\n", path);
+        exit(-1);
+    }
+    const u8* m = (const u8*) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        printf("Failed to map checkpoint %s.\n", path);
+        exit(-1);
+    }
+
+    const ckhead* h = (const ckhead*) m;
+    ckhead want;
+    cklayout(&want, S);
+    if (h->magic != CKMAGIC || h->version != CKVERSION) {
+        printf("%s is not a version %d checkpoint.\n", path, CKVERSION);
+        exit(-1);
+    }
+    if (h->n != want.n || h->clen != want.clen || h->stride != want.stride ||
+        h->circoff != want.circoff || h->codeoff != want.codeoff || h->repoff != want.repoff ||
+        h->size != want.size || (u64) sb.st_size != want.size) {
+        printf("Checkpoint %s is for %lu circuits of length %lu, expected %lu of %lu.\n",
+               path, h->n, h->clen, want.n, want.clen);
+        exit(-1);
+    }
+    *st = h->st;
+
+    const ckcirc* cs = (const ckcirc*) (m + h->circoff);
+    for (u64 i = 0; i < S->n; ++i) {
+        circ* c = &S->circs[i];
+        c->energy = cs[i].energy;
+        c->hash = cs[i].hash;
+        c->defects = cs[i].defects;
+        c->zeros = cs[i].zeros;
+        c->born = cs[i].born;
+        c->spent = cs[i].spent;
+        c->reps = cs[i].reps;
+        c->rate = cs[i].rate;
+        c->rated = cs[i].rated;
+    }
+    memcpy(S->code, m + h->codeoff, sizeof(u64) * S->n * S->stride);
+    memcpy(S->repcode, m + h->repoff, sizeof(u64) * S->n * S->stride);
+    munmap((void*) m, sb.st_size);
+    for (u64 i = 0; i < S->n; ++i) reachcirc(&S->circs[i]);
+}
@@ -1,14 +1,15 @@
 #pragma once
 
 #include "types.h"
-#include "heap.h"
+#include "conf.h"
+#include "evq.h"
+#include "task.h"
+#include "simstats.h"
+#include "prof.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-#define MINDEL (0.5f)
-#define MAXDEL (4.f)
-
 typedef struct {
     u64 energy;
     u64* code;
@@ -18,6 +19,20 @@ typedef struct {
     u64 defects;
     u64 zeros;
     u64 born;
+    /* Energy used over all passes of the last run, before the refund */
+    u64 spent;
+    /* Passes the last run scored. Under testreps, the run was cut short and
+     * defects is extrapolated (censored). */
+    u64 reps;
+    /* Running defects per pass, and the passes behind it. Reset when the
+     * genome changes. */
+    f64 rate;
+    u64 rated;
+    /* What the genome can do at all (see reachcirc): the input taps (bit 0
+     * A, 1 B, 2 t, 3 P) whose HI can get to complete, and the events in one
+     * episode, UINT64_MAX if the queue never drains */
+    u64 reach;
+    u64 epev;
 } circ;
 
 u64 ru(u64* state) {
@@ -37,21 +52,177 @@ u64 ru(u64* state) {
 	return result;
 }
 
+void seedr(u64* state, u64 seed) {
+    state[0] = 0xb6d47cfacccc53f8LU ^ seed;
+    state[1] = 0x30b319a052624be7LU ^ seed;
+    state[2] = 0xfbeb173c6d0227d8LU ^ seed;
+    state[3] = 0x99cfe60a00bdd4feLU ^ seed;
+}
+
+/* Steps the low word of s[0] as a multiplicative LCG. Works on the word's
+ * value, not its bytes, so the stream does not depend on aliasing rules. */
 f32 rf(u64 *s) {
-    u32* seed = (u32*) s;
+    u32 lo = (u32) s[0] * 16807U;
+    s[0] = (s[0] & ~0xffffffffLU) | lo;
+    u32 bits = (lo >> 9U) | 0x3f800000U;
     f32 res;
-    seed[0] = (i32) (((i32) seed[0]) * 16807);
-    *((u32*) &res) = (((seed[0]) >> 9U) | 0x3f800000U);
+    memcpy(&res, &bits, sizeof(res));
     return res - 1.f;
 }
 
+/* Hash of a code array. Every word is mixed in with its position, and the
+ * sum is finalized with the splitmix64 avalanche. */
+u64 hashcode(const u64* code, u64 clen) {
+    u64 h = clen * 0x9e3779b97f4a7c15LU;
+
+    for (u64 i = 0; i < clen; ++i) {
+        h ^= code[i] + 0x9e3779b97f4a7c15LU + (h << 6U) + (h >> 2U);
+        h *= 0xbf58476d1ce4e5b9LU;
+    }
+    h ^= h >> 30U;
+    h *= 0xbf58476d1ce4e5b9LU;
+    h ^= h >> 27U;
+    h *= 0x94d049bb133111ebLU;
+    h ^= h >> 31U;
+    return h;
+}
+
 void hashcirc(circ* c) {
-    c->hash = 0;
+    c->hash = hashcode(c->code, c->clen);
+}
 
-    for (u64 i = 0; i < c->clen; ++i) {
-        c->hash ^= 1LU << (c->code[i] % 61U);
-        c->hash ^= (1LU << 61U) << (c->code[i] % 3U); 
+/* Reduce c's genome to its phenotype in out[0..clen): what is left can
+ * still affect a simulation, and two genomes with equal phenotypes simulate
+ * identically. Returns the phenotype's hash.
+ *
+ * - Targets only matter modulo clen * 2 and are stored reduced.
+ * - The input taps (0..3) only contribute targets; events sent to them are
+ *   patched to 4..7, so their gate bits are never read.
+ * - The outputs (4, 5) never fire.
+ * - Gates no event can reach from the taps are dropped. */
+u64 phenocirc(const circ* c, u64* out) {
+    u64 dmsk = ((1U << 31U) - 1U);
+    u64 clen = c->clen;
+    u64 m = clen * 2;
+    u32 stk[clen];
+    u8 seen[clen];
+    u64 sp = 0;
+
+    memset(out, 0, sizeof(u64) * clen);
+    memset(seen, 0, clen);
+    /* The taps are always live. Walk every gate they reach. */
+    for (u64 j = 0; j < 4; ++j) stk[sp++] = j;
+    while (sp > 0) {
+        u64 j = stk[--sp];
+        u64 g = c->code[j];
+        u64 t[2] = { ((g >> 2U) & dmsk) % m, (g >> 33U) % m };
+        out[j] = (t[0] << 2U) | (t[1] << 33U);
+        if (j >= 4) out[j] |= g & 0b11LU;
+
+        for (u64 k = 0; k < 2; ++k) {
+            u64 tind = t[k] % clen;
+            if (tind < 4) tind += 4;
+            if (tind < 6 || seen[tind]) continue;
+            seen[tind] = 1;
+            stk[sp++] = tind;
+        }
     }
+
+    return hashcode(out, clen);
+}
+
+/* Node an event sent to t lands on. Events sent to the taps are patched to
+ * 4..7. */
+static inline u64 reachnode(u64 t, u64 clen) {
+    u64 j = t % clen;
+    return (j < 4) ? j + 4 : j;
+}
+
+static inline u64 reachadd(u64 a, u64 b) {
+    return (a + b < a) ? UINT64_MAX : a + b;
+}
+
+/* Events popped from an event landing on node j on, saturating. st marks
+ * gates on the current walk (1) and finished (2); a gate reached again
+ * while on the walk is a loop, which never drains. */
+static u64 reachev(const circ* c, u64 j, u8* st, u64* ev) {
+    u64 dmsk = ((1U << 31U) - 1U);
+    if (j < 6) return 1;
+    if (st[j] == 2) return ev[j];
+    if (st[j] == 1) return UINT64_MAX;
+    st[j] = 1;
+    u64 g = c->code[j];
+    u64 a = reachev(c, reachnode((g >> 2U) & dmsk, c->clen), st, ev);
+    u64 b = reachev(c, reachnode(g >> 33U, c->clen), st, ev);
+    st[j] = 2;
+    ev[j] = reachadd(reachadd(a, b), 1);
+    return ev[j];
+}
+
+/* Static analysis of c's genome into c->reach and c->epev. Run on every
+ * newborn; see circdead() for what it buys.
+ *
+ * A gate puts out more than 0.7 only if its a input is above 0.7, and only
+ * an event sent to exactly node j (not j + clen, and not a patched tap)
+ * sets gate j's a input. So a HI level travels from a tap along a inputs
+ * alone, and can land on complete (5) from the last hop. Taps none of whose
+ * a-input paths get to complete leave it below 0.7 whatever the delays.
+ *
+ * Every event on a gate sends two more, and the taps send two each, so the
+ * events in an episode are a count of paths: finite unless a gate the taps
+ * reach can reach itself. Neither depends on the row or the noise. */
+void reachcirc(circ* c) {
+    u64 dmsk = ((1U << 31U) - 1U);
+    u64 clen = c->clen;
+    u64 m = clen * 2;
+    u32 stk[clen];
+    u8 seen[clen];
+    u64 ev[clen];
+
+    c->reach = 0;
+    for (u64 i = 0; i < 4; ++i) {
+        u64 sp = 0;
+        memset(seen, 0, clen);
+        stk[sp++] = i;
+        while (sp > 0 && !(c->reach & (1LU << i))) {
+            u64 g = c->code[stk[--sp]];
+            u64 t[2] = { (g >> 2U) & dmsk, g >> 33U };
+            for (u64 k = 0; k < 2; ++k) {
+                u64 a = t[k] % m;
+                if (reachnode(t[k], clen) == 5) {
+                    c->reach |= 1LU << i;
+                } else if (a >= 6 && a < clen && !seen[a]) {
+                    seen[a] = 1;
+                    stk[sp++] = a;
+                }
+            }
+        }
+    }
+
+    memset(seen, 0, clen);
+    c->epev = 0;
+    for (u64 i = 0; i < 4; ++i) {
+        u64 g = c->code[i];
+        c->epev = reachadd(c->epev, reachev(c, reachnode((g >> 2U) & dmsk, clen), seen, ev));
+        c->epev = reachadd(c->epev, reachev(c, reachnode(g >> 33U, clen), seen, ev));
+    }
+}
+
+/* Set up a circuit over zeroed code and repcode arrays of len + 5 words */
+void placecirc(circ* out, u64 len, u64* code, u64* repcode) {
+    out->hash = 0;
+    out->clen = len + 5;
+    out->code = code;
+    out->repcode = repcode;
+    out->defects = UINT64_MAX;
+    out->energy = 50;
+    out->zeros = 0;
+    out->spent = 0;
+    out->reps = 0;
+    out->rate = 0.0;
+    out->rated = 0;
+    hashcirc(out);
+    reachcirc(out);
 }
 
 circ* initcirc(u64 len) {
@@ -60,18 +231,13 @@ circ* initcirc(u64 len) {
         printf("Failed to init circuit\n");
         exit(-1);
     }
-    out->hash = 0;
-    out->clen = len + 5;
-    out->code = (u64*) calloc(out->clen, sizeof(u64));
-    out->repcode = (u64*) calloc(out->clen, sizeof(u64));
-    if (out->code == NULL || out->repcode == NULL) {
+    u64* code = (u64*) calloc(len + 5, sizeof(u64));
+    u64* repcode = (u64*) calloc(len + 5, sizeof(u64));
+    if (code == NULL || repcode == NULL) {
         printf("Failed to init circuit.\n");
         exit(-1);
     }
-    out->defects = UINT64_MAX;
-    out->energy = 50;
-    out->zeros = 0;
-    hashcirc(out);
+    placecirc(out, len, code, repcode);
     return out;
 }
 
@@ -88,7 +254,9 @@ void randcirc(u64* state, circ* c) {
         c->repcode[i] = ru(state);
     }
     c->zeros = 0;
+    c->rated = 0;
     hashcirc(c);
+    reachcirc(c);
 }
 
 void mutcirc(u64* state, circ* c, f32 tmut, f32 bmut) {
@@ -105,8 +273,10 @@ void mutcirc(u64* state, circ* c, f32 tmut, f32 bmut) {
     }
 
     c->zeros = 0;
+    c->rated = 0;
 
     hashcirc(c);
+    reachcirc(c);
 }
 
 void crosscirc(u64* state, circ* c, circ* a, circ* b) {
@@ -122,489 +292,164 @@ void crosscirc(u64* state, circ* c, circ* a, circ* b) {
         memcpy(c->code + xover, a->code + xover, (a->clen - xover) * sizeof(u64));
     }
     c->zeros = 0;
+    c->rated = 0;
+
+    hashcirc(c);
+    reachcirc(c);
 }
 
 void repcirc(circ* c, circ* a) {
     memcpy(c->code, a->code, sizeof(u64) * a->clen);
     memcpy(c->repcode, a->repcode, sizeof(u64) * a->clen);
     // for (u64 i = 0; i < a->clen; ++i) c->code[i] ^= c->repcode[i];
+    c->hash = a->hash;
+    c->reach = a->reach;
+    c->epev = a->epev;
     c->zeros = 0;
+    c->rated = 0;
 }
 
 f32 calcdel(u64* state, f32 mindel, f32 maxdel, f32 t, u32 tr) {
     return mindel + (rf(state) * (maxdel - mindel));
 }
 
-void test0(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* LO signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 0.1f);
-    
-    /* LO signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 0.1f);
-
-    /* HI signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 1.f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
 
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 0: 0 0 1 -> 0 1 or x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                if (vins[4] > 0.7f) {
-                    /* Illegal: 0 0 1 -> 1 1 */
-                    c->defects++;
-                }
-            }
-
-            if (vins[4] > 0.7f) {
-                if (vins[5] > 0.7f) {
-                    /* Illegal: 0 0 1 -> 1 1 */
-                    c->defects++;
-                }
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
+/* Voltage buffer for one simulation. Entries that go nonzero are logged in
+ * dirty so the end of an episode only clears what it touched. */
+typedef struct {
+    f32* vins;
+    u32* dirty;
+    u64 nd;
+    u64 cap;
+    /* Most events queued at once, since its owner last cleared it */
+    u64 qpeak;
+} simbuf;
+
+simbuf* initsimbuf(u64 clen) {
+    simbuf* out = (simbuf*) malloc(sizeof(simbuf));
+    if (out == NULL) {
+        printf("Failed to alloc voltage array.\n");
+        exit(-1);
     }
-
-    /* Must eventually 'complete' */
-    /* 0 0 1 -> 0 1 */
-    if (!(vins[5] > 0.7f)) c->defects++;
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
+    out->cap = clen * 2;
+    out->nd = 0;
+    out->qpeak = 0;
+    out->vins = (f32*) calloc(out->cap, sizeof(f32));
+    out->dirty = (u32*) malloc(sizeof(u32) * out->cap);
+    if (out->vins == NULL || out->dirty == NULL) {
+        printf("Failed to alloc voltage array.\n");
+        exit(-1);
+    }
+    return out;
 }
 
-void test1(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* LO signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 0.1f);
-    
-    /* HI signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 1.f);
-
-    /* HI signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 1.f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
-
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 1: 0 1 1 -> 0 1 or x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                if (vins[4] > 0.7f) {
-                    /* Illegal: 0 1 1 -> 1 1 */
-                    c->defects++;
-                }
-            }
-
-            if (vins[4] > 0.7f) {
-                if (vins[5] > 0.7f) {
-                    /* Illegal: 0 1 1 -> 1 1 */
-                    c->defects++;
-                }
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
+void freesimbuf(simbuf* sb) {
+    free(sb->vins);
+    free(sb->dirty);
+    free(sb);
+}
 
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
+static inline void setv(simbuf* sb, u32 i, f32 v) {
+    if (sb->vins[i] == 0.f && v != 0.f) {
+        /* Past cap the log is abandoned and the reset falls back to memset */
+        if (sb->nd < sb->cap) sb->dirty[sb->nd] = i;
+        sb->nd++;
     }
-
-    /* Must eventually 'complete' */
-    /* 0 1 1 -> 0 1 */
-    if (!(vins[5] > 0.7f)) c->defects++;
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
+    sb->vins[i] = v;
 }
 
-void test2(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* HI signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 1.f);
-    
-    /* LO signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 0.1f);
-
-    /* HI signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 1.f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
+static inline void resetsimbuf(simbuf* sb) {
+    if (sb->nd > sb->cap) {
+        memset(sb->vins, 0, sizeof(f32) * sb->cap);
+    } else {
+        for (u64 i = 0; i < sb->nd; ++i) sb->vins[sb->dirty[i]] = 0.f;
+    }
+    sb->nd = 0;
+}
 
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 2: 1 0 1 -> 0 1 or x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                if (vins[4] > 0.7f) {
-                    /* Illegal: 1 0 1 -> 1 1 */
-                    c->defects++;
-                }
+/* Output of gate g with gate input a and select s */
+static inline f32 gateout(u64 g, f32 a, f32 s) {
+    /* Forward 0.1 unless connected. LO, but circuit is active. */
+    f32 out = 0.1f;
+
+    if ((g & 0b10LU)) {
+        /* Wire */
+        out = a;
+    } else if ((g & 1LU)) {
+        /* 1 : P-type */
+        /* TODO: Small loss 'a'=1, large loss 'a'=0 */
+        if (s < 0.3f) {
+            /* LO : Connected */
+            /* Forward current value of 'a' to both recipients */
+            if (a > 0.7f) {
+                out = a * 0.95;
+            } else if (a < 0.3f) {
+                out = a * 0.75;
             }
-
-            if (vins[4] > 0.7f) {
-                if (vins[5] > 0.7f) {
-                    /* Illegal: 1 0 1 -> 1 1 */
-                    c->defects++;
-                }
-            }
-
-            continue;
         }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
+    } else {
+        /* 0 : N-type */
+        /* TODO: Small loss 'a'=0, large loss 'a'=1 */
+        if (s > 0.7f) {
+            /* HI : Connected */
+            /* Forward current value of 'a' to both recipients */
+            if (a < 0.3f) {
+                out = a * 0.95;
+            } else if (a > 0.7f) {
+                out = a * 0.75;
             }
         }
     }
 
-    /* Must eventually 'complete' */
-    /* 1 0 1 -> 0 1 */
-    if (!(vins[5] > 0.7f)) c->defects++;
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
+    return out;
 }
 
-void test3(sigheap* h, f32* vins, circ* c, u64* seed) {
+/* One test episode: drive the row's levels onto the input taps and run the
+ * event loop until it drains or the circuit runs out of energy.
+ *
+ * rt and ry are the row's t and y passed separately so the specializations
+ * below can fold the output check to a constant; everything else about the
+ * row is only read while seeding the queue. cl is c->clen, likewise. */
+static inline __attribute__((always_inline))
+void episodek(evq* h, simbuf* sb, circ* c, u64* seed, const taskrow* r, u32 rt, u32 ry, u64 cl) {
     u64 dmsk = ((1U << 31U) - 1U);
+    f32* vins = sb->vins;
+    f32 mindel = conf.mindel;
+    f32 maxdel = conf.maxdel;
+    SSLOCAL;
+    SSINC(tests);
+    u64 nev = 0;
+    u64 qp = 0;
 
     f32 currt = 0.f;
 
-    /* HI signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 1.f);
-    
-    /* HI signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 1.f);
-
-    /* HI signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 1.f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
+    /* Signals from A, B, t and P (power) */
+    f32 lvls[4] = { r->a ? HI : LO, r->b ? HI : LO, rt ? HI : LO, HI };
+    for (u64 i = 0; i < 4; ++i) {
+        u32 o1 = (c->code[i] >> 2U) & dmsk;
+        u32 o2 = (c->code[i] >> 33U);
+        f32 d1 = calcdel(seed, mindel, maxdel, currt, o1);
+        f32 d2 = calcdel(seed, mindel, maxdel, currt, o2);
+        PFTIME(PFEVQ, evqins2(h, currt + d1, o1, currt + d2, o2, lvls[i]));
+    }
 
     u32 currind = 0;
     u32 tind = 0;
     f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
+    while (1) {
+        int empty;
+        PFTIME(PFEVQ, empty = evqrem(h, &currt, &currind, &currv));
+        if (empty != 0) break;
         if (c->energy > 0) {
             c->energy--;
         } else {
+            SSINC(starved);
             break;
         }
+        nev++;
 
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
+        currind %= (cl * 2);
+        tind = currind % cl;
 
         if (tind < 4) {
             /* Patch in */
@@ -612,23 +457,16 @@ void test3(sigheap* h, f32* vins, circ* c, u64* seed) {
         }
         if (tind < 6) {
             /* Output nodes. */
-            /* Test 3: 1 1 1 -> 1 1 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                if (!(vins[4] > 0.7f)) {
-                    /* Illegal: 
-                     * 1 1 1 -> 0 1 
-                     * 1 1 1 -> ∅ 1 */
-                    c->defects++;
+            SSINC(outhits);
+            setv(sb, tind, currv);
+            if (rt) {
+                /* If 'complete' goes HI, data must match */
+                if (ry != YX && vins[5] > 0.7f && (vins[4] > 0.7f) != ry) {
+                    c->defects += GLITCHW;
                 }
-            }
-
-            if (!(vins[4] > 0.7f)) {
+            } else {
+                /* 'complete' must not go HI */
                 if (vins[5] > 0.7f) {
-                    /* Illegal: 
-                     * 1 1 1 -> 0 1 
-                     * 1 1 1 -> ∅ 1 */
                     c->defects++;
                 }
             }
@@ -636,602 +474,85 @@ void test3(sigheap* h, f32* vins, circ* c, u64* seed) {
             continue;
         }
 
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
-    }
-
-    /* Must eventually 'complete' */
-    /* 1 1 1 -> 1 1 */
-    if (!(vins[5] > 0.7f)) c->defects++;
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
-}
-
-void test4(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
+        setv(sb, currind, currv);
 
-    f32 currt = 0.f;
+        u64 g = c->code[tind];
+        u32 t1 = (g >> 2U) & dmsk;
+        u32 t2 = (g >> 33U);
+        f32 a = vins[tind];
+        f32 s = vins[tind + cl];
+        f32 out = gateout(g, a, s);
 
-    /* LO signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 0.1f);
-    
-    /* LO signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 0.1f);
-
-    /* LO signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 0.1f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
+        f32 d1 = calcdel(seed, mindel, maxdel, currt, t1 ^ currind);
+        f32 d2 = calcdel(seed, mindel, maxdel, currt, t2 ^ currind);
+        PFTIME(PFEVQ, evqins2(h, currt + d1, t1, currt + d2, t2, out));
 
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
+        if (g & 0b10LU) {
+            SSINC(wires);
+        } else if (g & 1LU) {
+            SSINC(ptype);
         } else {
-            break;
-        }
-        
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
-
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 4: 0 0 0 -> x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                c->defects++;
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
+            SSINC(ntype);
         }
+        if (evqlen(h) > qp) qp = evqlen(h);
+        SSHIST(qhist, evqlen(h));
+        SSMAX(qpeak, evqlen(h));
     }
+    SSADD(events, nev);
+    if (qp > sb->qpeak) sb->qpeak = qp;
+    SSHIST(evhist, nev);
 
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
+    /* Must eventually 'complete' */
+    if (rt && !(vins[5] > 0.7f)) c->defects++;
+    resetsimbuf(sb);
+    evqclear(h);
 }
 
-void test5(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* LO signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 0.1f);
-    
-    /* HI signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 1.f);
-
-    /* LO signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 0.1f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
-
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 5: 0 1 0 -> x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                c->defects++;
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
+/* Genome lengths, fixed nodes included, with their own kernels: circln 20,
+ * the default 40, and 80. Wrapping node indices by a constant costs a
+ * multiply instead of a divide. Other lengths take the generic kernel. */
+#define EPCLENS(X, t, y) X(t, y, 25) X(t, y, 45) X(t, y, 85)
+#define EPCASE(t, y, cl) case cl: episodek(h, sb, c, seed, r, t, y, cl); return;
+
+/* Specializations by output rule, then by length. Rows of a fixed task
+ * dispatch to these at compile time; a task with eight rows shares at most
+ * three kernels, so a build is left with some it never calls. */
+#define DEFEPISODE(t, y) \
+    static __attribute__((unused)) void episode_##t##_##y(evq* h, simbuf* sb, circ* c, u64* seed, const taskrow* r) { \
+        switch (c->clen) { \
+        EPCLENS(EPCASE, t, y) \
+        default: episodek(h, sb, c, seed, r, t, y, c->clen); \
+        } \
     }
 
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
-}
-
-void test6(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* HI signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 1.f);
-    
-    /* LO signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 0.1f);
-
-    /* LO signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 0.1f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
-
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 6: 1 0 0 -> x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                c->defects++;
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
+DEFEPISODE(1, Y0)
+DEFEPISODE(1, Y1)
+DEFEPISODE(1, YX)
+DEFEPISODE(0, Y0)
+DEFEPISODE(0, Y1)
+DEFEPISODE(0, YX)
+
+/* Table-driven kernel for tasks loaded at runtime */
+void episode(evq* h, simbuf* sb, circ* c, u64* seed, const taskrow* r) {
+    switch (c->clen) {
+    EPCLENS(EPCASE, r->t, r->y)
+    default: episodek(h, sb, c, seed, r, r->t, r->y, c->clen);
     }
-
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
 }
 
-void test7(sigheap* h, f32* vins, circ* c, u64* seed) {
-    u64 dmsk = ((1U << 31U) - 1U);
-
-    f32 currt = 0.f;
-
-    /* HI signal from A */
-    u32 a1 = (c->code[0] >> 2U) & dmsk;
-    u32 a2 = (c->code[0] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a1), a1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, a2), a2, 1.f);
-    
-    /* HI signal from B */
-    u32 b1 = (c->code[1] >> 2U) & dmsk;
-    u32 b2 = (c->code[1] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b1), b1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, b2), b2, 1.f);
-
-    /* LO signal from t */
-    u32 t1 = (c->code[2] >> 2U) & dmsk;
-    u32 t2 = (c->code[2] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1), t1, 0.1f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2), t2, 0.1f);
-
-    /* HI signal from P (power) */
-    u32 P1 = (c->code[3] >> 2U) & dmsk;
-    u32 P2 = (c->code[3] >> 33U);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P1), P1, 1.f);
-    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, P2), P2, 1.f);
-
-    u32 currind = 0;
-    u32 tind = 0;
-    f32 currv = 0.f;
-    while (remmin(h, &currt, &currind, &currv) == 0) {
-        if (c->energy > 0) {
-            c->energy--;
-        } else {
-            break;
-        }
-        
-        currind %= (c->clen * 2);
-        tind = currind % c->clen;
-
-        if (tind < 4) {
-            /* Patch in */
-            tind += 4;
-        }
-        if (tind < 6) {
-            /* Output nodes. */
-            /* Test 7: 1 1 0 -> x 0 */
-            vins[tind] = currv;
-            /* If 'complete' goes HI */
-            if (vins[5] > 0.7f) {
-                c->defects++;
-            }
-
-            continue;
-        }
-
-        vins[currind] = currv;
-
-        t1 = (c->code[tind] >> 2U) & dmsk;
-        t2 = (c->code[tind] >> 33U);
-
-        if ((c->code[tind] & 0b10LU)) {
-            /* Wire */
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind]);
-            insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind]);
-        } else {
-            if ((c->code[tind] & 1LU)) {
-                /* 1 : P-type */
-                /* LO : Connected */
-                /* TODO: Small loss 'a'=1, large loss 'a'=0 */
-                if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            } else {
-                /* 0 : N-type */
-                /* HI : Connected */
-                /* TODO: Small loss 'a'=0, large loss 'a'=1 */
-                if (vins[tind + c->clen] > 0.7f) {
-                    /* HI : Connected */
-                    /* Forward current value of 'a' to both recipients */
-                    if (vins[tind] < 0.3f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.95);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.95);
-                    } else if (vins[tind] > 0.7f) {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, vins[tind] * 0.75);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, vins[tind] * 0.75);
-                    } else {
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                        insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                    }
-                } else if (vins[tind + c->clen] < 0.3f) {
-                    /* LO : Disconnected */
-                    /* Forward 0.1 to both recipients. LO, but circuit is active. */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                } else {
-                    /* ∅ : ∅ */
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t1 ^ currind), t1, 0.1f);
-                    insmin(h, currt + calcdel(seed, MINDEL, MAXDEL, currt, t2 ^ currind), t2, 0.1f);
-                }
-            }
-        }
-    }
+/* Early abort. Passes are scored in blocks of ABORTBLK; between blocks a run
+ * is stopped once it is already past the cut, or once its mean defects per
+ * pass exceed the cut's by a Hoeffding margin at confidence 1 - e^-ABORTLOGD.
+ * The range of a pass is taken as the worst pass seen so far. */
+#define ABORTBLK (32)
+#define ABORTLOGD (4.6)
 
-    memset(vins, 0, sizeof(f32) * c->clen * 2);
-    h->n = 0;
-}
+/* No cut: score every pass */
+#define NOCUT (UINT64_MAX)
 
-#define TESTREPS (512)
+/* Rolling re-evaluation. A circuit that already has a rate runs only a slice
+ * of passes, and its rate moves ROLLW of the way to the slice's. */
+#define ROLLW (0.25)
 
 void printcircuit(circ* c) {
     for (u64 i = 0; i < c->clen; ++i) {
@@ -1256,43 +577,59 @@ void printcircuit(circ* c) {
     }
 }
 
-int run(sigheap* h, u64* seednoise, circ* c, f32* vins) {
-    /* Lo: 0.0 - 0.3
-     *  ∅: 0.3 - 0.7
-     * Hi: 0.7 - 1.0 */
-    /* Async AND gate
-     * 0: 0 0 1 -> 0 1 or x 0
-     * 1: 0 1 1 -> 0 1 or x 0
-     * 2: 1 0 1 -> 0 1 or x 0
-     * 3: 1 1 1 -> 1 1 or x 0
-     * 4: 0 0 0 -> x 0
-     * 5: 0 1 0 -> x 0
-     * 6: 1 0 0 -> x 0
-     * 7: 1 1 0 -> x 0 */
+#define EPISODE(a, b, t, y) \
+    { \
+        const taskrow r = { a, b, t, y }; \
+        episode_##t##_##y(h, sb, c, seed, &r); \
+    }
+
+/* One pass over every row of tk, or of the compiled-in TASK if tk is NULL */
+void runpass(evq* h, simbuf* sb, circ* c, u64* seed, const task* tk) {
+    if (tk == NULL) {
+        TASK(EPISODE)
+        return;
+    }
 
-    c->defects = 0;
-    u64 bnrg, enrg;
+    for (u64 i = 0; i < tk->nrows; ++i) {
+        episode(h, sb, c, seed, &tk->rows[i]);
+    }
+}
 
-    bnrg = c->energy;
-    test0(h, vins, c, seednoise);
-    test1(h, vins, c, seednoise);
-    test2(h, vins, c, seednoise);
-    test3(h, vins, c, seednoise);
-    test4(h, vins, c, seednoise);
-    test5(h, vins, c, seednoise);
-    test6(h, vins, c, seednoise);
-    test7(h, vins, c, seednoise);
-    enrg = c->energy;
-    for (u64 i = 0; i < TESTREPS - 1; ++i) {
-        test0(h, vins, c, seednoise);
-        test1(h, vins, c, seednoise);
-        test2(h, vins, c, seednoise);
-        test3(h, vins, c, seednoise);
-        test4(h, vins, c, seednoise);
-        test5(h, vins, c, seednoise);
-        test6(h, vins, c, seednoise);
-        test7(h, vins, c, seednoise);
+/* Input taps HI on some row of tk */
+static inline u64 taskhot(const task* tk) {
+    if (tk == NULL) tk = &taskfixed;
+    u64 out = 0;
+    for (u64 i = 0; i < tk->nrows; ++i) {
+        const taskrow* r = &tk->rows[i];
+        out |= (r->a != 0) | ((u64) (r->b != 0) << 1U) | ((u64) (r->t != 0) << 2U) | (1LU << 3U);
     }
+    return out;
+}
+
+/* Whether c can never drive complete HI on any row of tk. Its episodes are
+ * then known without simulating them: see deadpass(). */
+static inline int circdead(const circ* c, const task* tk) {
+    return (c->reach & taskhot(tk)) == 0;
+}
+
+/* runpass() for a circuit circdead() holds for: each episode pops the
+ * circuit's epev events or what energy is left, and every request row
+ * misses its completion */
+static void deadpass(circ* c, const task* tk) {
+    if (tk == NULL) tk = &taskfixed;
+    SSLOCAL;
+    SSADD(dead, tk->nrows);
+    for (u64 i = 0; i < tk->nrows; ++i) {
+        c->energy -= (c->epev < c->energy) ? c->epev : c->energy;
+        if (tk->rows[i].t) c->defects++;
+    }
+}
+
+/* Close a run that started with bnrg and had enrg left after its first
+ * pass: refund the later passes, settle a run that spent nothing, and
+ * update the zeros streak. Returns the run cost. */
+static inline i64 runend(circ* c, u64 bnrg, u64 enrg) {
+    c->spent = bnrg - c->energy;
     c->energy = enrg;
     if (bnrg == enrg) {
         bnrg = c->energy;
@@ -1307,4 +644,63 @@ int run(sigheap* h, u64* seednoise, circ* c, f32* vins) {
         c->zeros = 0;
     }
     return bnrg - enrg;
+}
+
+/* Whether a run with defects over its first reps passes, none worse than
+ * rmax, should stop against cut (in full-run defects) */
+static inline int runabort(u64 defects, u64 reps, u64 rmax, u64 cut) {
+    if (cut == NOCUT || reps % ABORTBLK != 0) return 0;
+    if (defects > cut) return 1;
+
+    f64 d = defects / ((f64) reps) - cut / ((f64) conf.testreps);
+    return d > 0.0 && d * d > (rmax * (f64) rmax) * ABORTLOGD / (2.0 * reps);
+}
+
+/* Passes to run for c: a slice of roll if it is rated, else all */
+static inline u64 runwant(const circ* c, u64 roll) {
+    return (roll != 0 && c->rated != 0) ? roll : conf.testreps;
+}
+
+/* Score the reps passes just run. A full or censored run sets the rate, with
+ * a censored run's defects extrapolated; a slice updates it. */
+static inline void runscore(circ* c, u64 reps, u64 roll) {
+    if (roll != 0 && c->rated != 0) {
+        c->rate += ROLLW * (c->defects / ((f64) reps) - c->rate);
+        c->rated += reps;
+        c->defects = (u64) (c->rate * conf.testreps + 0.5);
+        c->reps = conf.testreps;
+        return;
+    }
+
+    c->reps = reps;
+    if (reps < conf.testreps) c->defects = (c->defects * conf.testreps) / reps;
+    c->rate = c->defects / ((f64) conf.testreps);
+    c->rated = reps;
+}
+
+/* One run: testreps passes, or a slice of roll passes if c is rated (roll 0
+ * to always run in full), stopped early if it falls past cut (NOCUT to
+ * disable) */
+int runtask(evq* h, u64* seednoise, circ* c, simbuf* sb, const task* tk, u64 cut, u64 roll) {
+    c->defects = 0;
+    u64 bnrg, enrg;
+    u64 want = runwant(c, roll);
+    int dead = circdead(c, tk);
+
+    bnrg = c->energy;
+    if (dead) deadpass(c, tk); else runpass(h, sb, c, seednoise, tk);
+    enrg = c->energy;
+    u64 rmax = c->defects;
+    u64 rep = 1;
+    for (; rep < want && !runabort(c->defects, rep, rmax, cut); ++rep) {
+        u64 d0 = c->defects;
+        if (dead) deadpass(c, tk); else runpass(h, sb, c, seednoise, tk);
+        if (c->defects - d0 > rmax) rmax = c->defects - d0;
+    }
+    runscore(c, rep, roll);
+    return runend(c, bnrg, enrg);
+}
+
+int run(evq* h, u64* seednoise, circ* c, simbuf* sb) {
+    return runtask(h, seednoise, c, sb, NULL, NOCUT, 0);
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Run configuration.
+ *
+ * Every parameter of a run lives in the global conf, set at startup before
+ * anything is allocated: the defaults below, then a config file
+ * (loadconf), then single overrides (confset). Nothing may change it once
+ * the run has started.
+ *
+ * Kernels whose loops depend on these sizes are compiled for the defaults
+ * and dispatch to a generic version otherwise: episodes per genome length
+ * (see EPCLENS) and the feeding and reproduction group draws per group
+ * size (see world.h). A run at the defaults keeps the constant-folded
+ * code. */
+
+#define POP (4096)
+#define CIRCLN (40)
+
+#define MAXITERS (5000000)
+
+/* Evaluation threads. 0 uses one per online CPU. */
+#define NTHREADS (0)
+
+/* Passes of the task per run, and the range of gate delays */
+#define TESTREPS (512)
+#define MINDEL (0.5f)
+#define MAXDEL (4.f)
+
+#define REPCST (1000)
+#define REPWHEN (1500)
+
+/* Choose an initial energy such that newborns die off
+ * immediately if they don't provide an improvement. If they
+ * do manage to be competitive, they may survive, and might also reproduce */
+#define INITENERG (800)
+
+#define COMPTHRESH (512)
+
+#define REW (800)
+#define FEEDINGS (1024)
+#define FDRAT (2)
+#define FDMX (2)
+#define FDSIZE (3)
+
+#define LMUR (0.0f)
+#define MUR (0.3f)
+#define TMUT (0.15f)
+#define BMUT (0.3f)
+
+#define REPRFREQ (0.0f)
+#define REPRSIZE (10)
+
+/* Early abort: cut runs short once they fall past this percentile of the
+ * last generation's defects (see runabort). Cut runs are scored by
+ * extrapolation. */
+#define EARLYABORT (0)
+#define ABORTPCT (0.75)
+
+/* Rolling re-evaluation: passes per generation for circuits that already
+ * have a rate (see runscore). Newborns and mutants are always scored in
+ * full. 0 scores everyone in full. */
+#define ROLLREPS (0)
+
+/* Offspring pre-screening: resample, up to SCREENTRIES times, offspring the
+ * surrogate model is sure will score worse than this percentile of the
+ * current generation (see surrreject) */
+#define SCREEN (0)
+#define SCREENPCT (0.9)
+#define SCREENTRIES (4)
+
+/* Island model (see islands.h): the population is split over ISLANDS
+ * threads, which trade their MIGRANTS best circuits around a ring every
+ * MIGEVERY generations. 1 runs one population. */
+#define ISLANDS (1)
+#define MIGEVERY (50)
+#define MIGRANTS (8)
+
+/* Largest feeding or reproduction group */
+#define GROUPMAX (64)
+
+/* X(type, name, default, scanf format) */
+#define CONFKEYS(X) \
+    X(u64, pop, POP, "%lu") \
+    X(u64, circln, CIRCLN, "%lu") \
+    X(u64, maxiters, MAXITERS, "%lu") \
+    X(u64, threads, NTHREADS, "%lu") \
+    X(u64, testreps, TESTREPS, "%lu") \
+    X(f32, mindel, MINDEL, "%f") \
+    X(f32, maxdel, MAXDEL, "%f") \
+    X(u64, repcst, REPCST, "%lu") \
+    X(u64, repwhen, REPWHEN, "%lu") \
+    X(u64, initenerg, INITENERG, "%lu") \
+    X(u64, compthresh, COMPTHRESH, "%lu") \
+    X(u64, rew, REW, "%lu") \
+    X(u64, feedings, FEEDINGS, "%lu") \
+    X(u64, fdrat, FDRAT, "%lu") \
+    X(u64, fdmx, FDMX, "%lu") \
+    X(u64, fdsize, FDSIZE, "%lu") \
+    X(f32, lmur, LMUR, "%f") \
+    X(f32, mur, MUR, "%f") \
+    X(f32, tmut, TMUT, "%f") \
+    X(f32, bmut, BMUT, "%f") \
+    X(f32, reprfreq, REPRFREQ, "%f") \
+    X(u64, reprsize, REPRSIZE, "%lu") \
+    X(u64, earlyabort, EARLYABORT, "%lu") \
+    X(f64, abortpct, ABORTPCT, "%lf") \
+    X(u64, rollreps, ROLLREPS, "%lu") \
+    X(u64, screen, SCREEN, "%lu") \
+    X(f64, screenpct, SCREENPCT, "%lf") \
+    X(u64, screentries, SCREENTRIES, "%lu") \
+    X(u64, islands, ISLANDS, "%lu") \
+    X(u64, migevery, MIGEVERY, "%lu") \
+    X(u64, migrants, MIGRANTS, "%lu")
+
+#define CONFFIELD(type, name, def, fmt) type name;
+#define CONFINIT(type, name, def, fmt) .name = def,
+
+typedef struct {
+    CONFKEYS(CONFFIELD)
+} config;
+
+config conf = { CONFKEYS(CONFINIT) };
+
+/* Set one parameter from "key=value". Returns 0 on success. */
+int confset(const char* kv) {
+    const char* eq = strchr(kv, '=');
+    if (eq == NULL) return -1;
+    u64 klen = eq - kv;
+    char end;
+
+#define CONFSET(type, name, def, fmt) \
+    if (klen == strlen(#name) && strncmp(kv, #name, klen) == 0) { \
+        return (sscanf(eq + 1, " " fmt " %c", &conf.name, &end) == 1) ? 0 : -1; \
+    }
+    CONFKEYS(CONFSET)
+#undef CONFSET
+
+    return -1;
+}
+
+/* Load a config file: one "key = value" per line, '#' starts a comment */
+void loadconf(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Failed to open config %s.\n", path);
+        exit(-1);
+    }
+
+    char line[256];
+    u64 lnum = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lnum++;
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+
+        /* Squeeze out whitespace around the key and the '=' */
+        char kv[256];
+        u64 n = 0;
+        for (char* p = line; *p != '\0'; ++p) {
+            if (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') kv[n++] = *p;
+        }
+        kv[n] = '\0';
+        if (n == 0) continue;
+
+        if (confset(kv) != 0) {
+            printf("%s:%lu: bad setting\n", path, lnum);
+            exit(-1);
+        }
+    }
+    fclose(f);
+}
+
+/* Reject settings the loops cannot run with */
+void confcheck() {
+    const char* bad = NULL;
+    if (conf.pop == 0) bad = "pop";
+    /* Taps 0..3 are patched to nodes 4..7, which must exist */
+    else if (conf.circln < 3) bad = "circln";
+    else if (conf.testreps == 0) bad = "testreps";
+    else if (!(conf.mindel > 0.f && conf.mindel <= conf.maxdel)) bad = "mindel";
+    else if (conf.fdrat == 0) bad = "fdrat";
+    else if (conf.fdsize == 0 || conf.fdsize > GROUPMAX || conf.fdmx > conf.fdsize) bad = "fdsize";
+    else if (conf.reprsize < 2 || conf.reprsize > GROUPMAX || conf.reprsize < conf.fdsize) bad = "reprsize";
+    else if (conf.abortpct < 0.0 || conf.abortpct > 1.0) bad = "abortpct";
+    else if (conf.screenpct < 0.0 || conf.screenpct > 1.0) bad = "screenpct";
+    else if (conf.islands == 0 || conf.pop / conf.islands == 0) bad = "islands";
+    else if (conf.migevery == 0) bad = "migevery";
+    else if (conf.migrants * 2 > conf.pop / conf.islands) bad = "migrants";
+    if (bad != NULL) {
+        printf("Bad setting for %s.\n", bad);
+        exit(-1);
+    }
+}
+
+/* Write every parameter as a config file line */
+void printconf(FILE* f) {
+#define CONFPRINT(type, name, def, fmt) fprintf(f, "%s = " fmt "\n", #name, conf.name);
+    CONFKEYS(CONFPRINT)
+#undef CONFPRINT
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "types.h"
+#include "circuit.h"
+#include "pool.h"
+#include "farm.h"
+#include <string.h>
+
+/* Per-generation evaluation cache.
+ *
+ * Every circuit in a generation is run against the same noise, so a run is
+ * fully determined by the phenotype (see phenocirc()), the task and the
+ * starting energy. Circuits are grouped by phenotype (hash, then an exact
+ * compare) and only the one with the most energy is simulated. Another
+ * member of the group takes its result if it started with the same energy,
+ * or if the simulated run never ran short (spent < energy) and the member
+ * has at least spent to give: both runs then pop the same events. Members
+ * that cannot reuse the result are simulated in a second batch.
+ *
+ * Early abort keeps this exact: a run stops on its defects alone, so two
+ * runs that pop the same events stop at the same pass. spent is then what
+ * the shortened run used.
+ *
+ * A rolling slice depends on the circuit's own rate, so rated circuits are
+ * never grouped when roll is on. */
+
+typedef struct {
+    u64 hash;
+    /* Slot in the population of the simulated circuit, plus one; 0 is empty */
+    u64 own;
+} cacheent;
+
+typedef struct {
+    cacheent* ents;
+    u64 mask;
+    u64 n;
+
+    /* Per circuit: slot of its group's simulated circuit, starting energy,
+     * phenotype and its hash */
+    u64* own;
+    u64* e0;
+    u64 clen;
+    u64* ph;
+    u64* phash;
+    /* Batch scratch */
+    circ** todo;
+    u64* todoi;
+    i64* todor;
+
+    /* Last generation. events counts the events actually simulated. */
+    u64 hits;
+    u64 lookups;
+    u64 events;
+} evcache;
+
+evcache* initevcache(u64 n, u64 clen) {
+    evcache* out = (evcache*) malloc(sizeof(evcache));
+    if (out == NULL) {
+        printf("Failed to init evaluation cache.\n");
+        exit(-1);
+    }
+    out->n = n;
+    /* At most half full */
+    u64 cap = 1;
+    while (cap < n * 2) cap <<= 1;
+    out->mask = cap - 1;
+    out->ents = (cacheent*) malloc(sizeof(cacheent) * cap);
+    out->own = (u64*) malloc(sizeof(u64) * n);
+    out->e0 = (u64*) malloc(sizeof(u64) * n);
+    out->clen = clen;
+    out->ph = (u64*) malloc(sizeof(u64) * n * clen);
+    out->phash = (u64*) malloc(sizeof(u64) * n);
+    out->todo = (circ**) malloc(sizeof(circ*) * n);
+    out->todoi = (u64*) malloc(sizeof(u64) * n);
+    out->todor = (i64*) malloc(sizeof(i64) * n);
+    if (out->ents == NULL || out->own == NULL || out->e0 == NULL || out->ph == NULL ||
+        out->phash == NULL || out->todo == NULL || out->todoi == NULL || out->todor == NULL) {
+        printf("Failed to init evaluation cache.\n");
+        exit(-1);
+    }
+    out->hits = 0;
+    out->lookups = 0;
+    out->events = 0;
+    return out;
+}
+
+void freeevcache(evcache* ec) {
+    free(ec->ents);
+    free(ec->own);
+    free(ec->e0);
+    free(ec->ph);
+    free(ec->phash);
+    free(ec->todo);
+    free(ec->todoi);
+    free(ec->todor);
+    free(ec);
+}
+
+/* Simulate ec->todo[0..k) and scatter the results back to their slots */
+static void cacheflush(evcache* ec, evpool* wp, u64 k, u64* seed, const task* tk, u64 cut, u64 roll, i64* res) {
+    if (k == 0) return;
+    if (wp->fm != NULL) {
+        farmrun(wp->fm, wp, ec->todo, k, seed, tk, cut, roll, ec->todor);
+    } else {
+        poolrun(wp, ec->todo, k, seed, tk, cut, roll, ec->todor);
+    }
+    for (u64 j = 0; j < k; ++j) {
+        res[ec->todoi[j]] = ec->todor[j];
+        ec->events += ec->todo[j]->spent;
+    }
+}
+
+/* Drop-in for poolrun() over pop[0..ec->n) */
+void cacherun(evcache* ec, evpool* wp, circ** pop, u64* seed, const task* tk, u64 cut, u64 roll, i64* res) {
+    u64 n = ec->n;
+    ec->events = 0;
+    memset(ec->ents, 0, sizeof(cacheent) * (ec->mask + 1));
+
+    /* Group by phenotype. The group's richest circuit is simulated. */
+    for (u64 i = 0; i < n; ++i) {
+        circ* c = pop[i];
+        if (c->clen != ec->clen) {
+            printf("Evaluation cache built for length %lu, got %lu.\n", ec->clen, c->clen);
+            exit(-1);
+        }
+        u64* ph = ec->ph + i * ec->clen;
+        ec->e0[i] = c->energy;
+        if (runwant(c, roll) != conf.testreps) {
+            ec->own[i] = UINT64_MAX;
+            continue;
+        }
+        ec->phash[i] = phenocirc(c, ph);
+
+        u64 s = ec->phash[i] & ec->mask;
+        while (1) {
+            cacheent* e = &ec->ents[s];
+            if (e->own == 0) {
+                e->hash = ec->phash[i];
+                e->own = i + 1;
+                break;
+            }
+            u64 o = e->own - 1;
+            if (e->hash == ec->phash[i] &&
+                memcmp(ec->ph + o * ec->clen, ph, sizeof(u64) * ec->clen) == 0) {
+                if (c->energy > pop[o]->energy) e->own = i + 1;
+                break;
+            }
+            s = (s + 1) & ec->mask;
+        }
+        ec->own[i] = s;
+    }
+
+    u64 k = 0;
+    for (u64 i = 0; i < n; ++i) {
+        ec->own[i] = (ec->own[i] == UINT64_MAX) ? i : ec->ents[ec->own[i]].own - 1;
+        if (ec->own[i] == i) {
+            ec->todo[k] = pop[i];
+            ec->todoi[k] = i;
+            k++;
+        }
+    }
+    cacheflush(ec, wp, k, seed, tk, cut, roll, res);
+
+    /* Everyone else reuses their group's run if it applies */
+    ec->hits = 0;
+    ec->lookups = n;
+    k = 0;
+    for (u64 i = 0; i < n; ++i) {
+        if (ec->own[i] == i) continue;
+        circ* c = pop[i];
+        circ* o = pop[ec->own[i]];
+        u64 oe = ec->e0[ec->own[i]];
+
+        if (c->energy == oe) {
+            c->defects = o->defects;
+            c->spent = o->spent;
+            c->reps = o->reps;
+            c->rate = o->rate;
+            c->rated = o->rated;
+            res[i] = res[ec->own[i]];
+            c->energy = o->energy;
+        } else if (o->spent < oe && o->spent <= c->energy) {
+            /* Neither run ran short. oe > 0, so the first pass spent
+             * something and runend() took its usual path. */
+            c->defects = o->defects;
+            c->spent = o->spent;
+            c->reps = o->reps;
+            c->rate = o->rate;
+            c->rated = o->rated;
+            res[i] = res[ec->own[i]];
+            c->energy -= res[i];
+        } else {
+            ec->todo[k] = c;
+            ec->todoi[k] = i;
+            k++;
+            continue;
+        }
+
+        if (c->defects == 0) {
+            c->zeros++;
+        } else {
+            c->zeros = 0;
+        }
+        ec->hits++;
+    }
+    cacheflush(ec, wp, k, seed, tk, cut, roll, res);
+}
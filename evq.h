@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.h"
+#include "conf.h"
+#include "heap.h"
+#include "pheap.h"
+#include "calq.h"
+
+/* Event queue used by the simulator. The packed heap is the default; define
+ * EVQ_SIGHEAP for the 4-ary sigheap or EVQ_CALQ for the calendar queue. All
+ * backends pop events in time order; they differ only in how ties are
+ * broken. evqins2 pushes the two events every gate emits; evqprefetch warms
+ * the lines the next evqrem reads; evqlen is the number of pending events. */
+
+#if defined(EVQ_CALQ)
+
+#define EVQNAME "calq"
+typedef calq evq;
+#define initevq() initcalq(conf.mindel, conf.maxdel)
+#define freeevq(q) freecalq(q)
+#define evqins(q, t, i, v) cqins(q, t, i, v)
+#define evqins2(q, t1, i1, t2, i2, v) (cqins(q, t1, i1, v), cqins(q, t2, i2, v))
+#define evqrem(q, t, i, v) cqrem(q, t, i, v)
+#define evqclear(q) cqclear(q)
+#define evqprefetch(q) cqprefetch(q)
+#define evqlen(q) ((q)->n)
+
+#elif defined(EVQ_SIGHEAP)
+
+#define EVQNAME "sigheap"
+typedef sigheap evq;
+#define initevq() initheap()
+#define freeevq(q) freeheap(q)
+#define evqins(q, t, i, v) insmin(q, t, i, v)
+#define evqins2(q, t1, i1, t2, i2, v) (insmin(q, t1, i1, v), insmin(q, t2, i2, v))
+#define evqrem(q, t, i, v) remmin(q, t, i, v)
+#define evqclear(q) ((q)->n = 0)
+#define evqprefetch(q) hprefetch(q)
+#define evqlen(q) ((q)->n)
+
+#else
+
+#define EVQNAME "pheap"
+typedef pheap evq;
+#define initevq() initpheap()
+#define freeevq(q) freepheap(q)
+#define evqins(q, t, i, v) phins(q, t, i, v)
+#define evqins2(q, t1, i1, t2, i2, v) phins2(q, t1, i1, t2, i2, v)
+#define evqrem(q, t, i, v) phrem(q, t, i, v)
+#define evqclear(q) ((q)->n = 0)
+#define evqprefetch(q) phprefetch(q)
+#define evqlen(q) ((q)->n)
+
+#endif
@@ -0,0 +1,536 @@
+#pragma once
+
+#include "types.h"
+#include "conf.h"
+#include "circuit.h"
+#include "task.h"
+#include "pool.h"
+#include "slab.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Evaluation farm.
+ *
+ * A run is a pure function of the genome, the starting energy, zeros and
+ * rate, the generation's noise seed, the task and a few settings, so the
+ * master can ship it to other processes. Workers (evocirc -w addr) connect
+ * to a master (evocirc -m addr), which then sends the batches of a poolrun()
+ * to them instead of its own threads. Addresses are unix:path or host:port.
+ *
+ * Frames are native-endian u64 words, so master and workers must share a
+ * byte order (the magic catches a mismatch) and a build.
+ *
+ *   hello  master -> worker, once: magic, version, clen, batch, testreps,
+ *          mindel, maxdel (f32 bits), nrows, then one word per task row
+ *          (a, b, t, y bytes). nrows 0 runs the compiled-in task.
+ *   batch  master -> worker: id, n, seed[4], cut, roll, then per circuit
+ *          energy, zeros, rated, rate (f64 bits), code[clen].
+ *   result worker -> master: id, n, then per circuit defects, energy,
+ *          spent, reps, zeros, rated, rate, runtask()'s result.
+ *
+ * Every worker has up to FARMDEPTH batches in flight, so the next batch is
+ * already queued on its socket while it answers the last one. Workers
+ * answer in order. A worker whose socket fails or closes, or that leaves its
+ * oldest batch unanswered for FARMTIMEOUT, is dropped and its batches go
+ * back on the queue for the others; with no workers left the
+ * master runs what is left itself. Results do not depend on who ran them. */
+
+#define FARMMAGIC (0x4d52414643564545LU)
+#define FARMVERSION (1)
+
+/* Circuits per batch, and batches in flight per worker */
+#define FARMBATCH (64)
+#define FARMDEPTH (2)
+
+#define FARMCONNS (256)
+
+/* Seconds a worker may take to answer its oldest batch, and to finish a
+ * frame it started sending */
+#define FARMTIMEOUT (30)
+
+/* Connection attempts a starting worker makes, a second apart */
+#define FARMRETRY (30)
+
+#define FARMHELLO (8)
+#define FARMBHEAD (8)
+#define FARMIN (4)
+#define FARMRHEAD (2)
+#define FARMOUT (8)
+
+typedef struct {
+    int fd;
+    /* Batches sent and not yet answered, oldest first */
+    u64 fly[FARMDEPTH];
+    u64 nfly;
+    /* When fly[0] is overdue, from farmnow() */
+    f64 due;
+} farmconn;
+
+typedef struct farm {
+    int lfd;
+    /* Socket file to remove, for unix addresses */
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    farmconn cs[FARMCONNS];
+    u64 nconn;
+    /* Frame scratch, sized for clen */
+    u64* buf;
+    u64 clen;
+    /* Batches of the current run still to send */
+    u64* pend;
+    u64 npend;
+    u64 cap;
+    u64 run;
+
+    /* Over the whole run */
+    u64 joined;
+    u64 sent;
+    u64 redone;
+} farm;
+
+static f64 farmnow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Write or read all of len bytes. Returns nonzero on failure or EOF. */
+static int farmsend(int fd, const void* p, u64 len) {
+    const u8* b = (const u8*) p;
+    while (len > 0) {
+        ssize_t k = send(fd, b, len, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        b += k;
+        len -= k;
+    }
+    return 0;
+}
+
+static int farmrecv(int fd, void* p, u64 len) {
+    u8* b = (u8*) p;
+    while (len > 0) {
+        ssize_t k = recv(fd, b, len, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        b += k;
+        len -= k;
+    }
+    return 0;
+}
+
+/* Open a socket for addr, bound and listening if serve, else connected.
+ * Returns -1 on failure. */
+static int farmsock(const char* addr, int serve, char* path) {
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (strlen(addr + 5) >= sizeof(sa.sun_path)) return -1;
+        strcpy(sa.sun_path, addr + 5);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (serve) {
+            unlink(sa.sun_path);
+            if (bind(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0 || listen(fd, FARMCONNS) != 0) {
+                close(fd);
+                return -1;
+            }
+            if (path != NULL) strcpy(path, sa.sun_path);
+        } else if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /* host:port, host may be empty or bracketed */
+    char host[256];
+    const char* colon = strrchr(addr, ':');
+    if (colon == NULL || (u64) (colon - addr) >= sizeof(host)) return -1;
+    const char* h = addr;
+    u64 hlen = colon - addr;
+    if (hlen >= 2 && h[0] == '[' && h[hlen - 1] == ']') {
+        h++;
+        hlen -= 2;
+    }
+    memcpy(host, h, hlen);
+    host[hlen] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = serve ? AI_PASSIVE : 0;
+    struct addrinfo* ai;
+    if (getaddrinfo(hlen > 0 ? host : NULL, colon + 1, &hints, &ai) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo* a = ai; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        int ok;
+        if (serve) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, FARMCONNS) == 0;
+        } else {
+            ok = connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+            /* Frames are small and answered one by one */
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/* Listen on addr for workers */
+farm* initfarm(const char* addr) {
+    farm* out = (farm*) calloc(1, sizeof(farm));
+    if (out == NULL) {
+        printf("Failed to init farm.\n");
+        exit(-1);
+    }
+    out->lfd = farmsock(addr, 1, out->path);
+    if (out->lfd < 0) {
+        printf("Failed to listen on %s.\n", addr);
+        exit(-1);
+    }
+    for (u64 i = 0; i < FARMCONNS; ++i) out->cs[i].fd = -1;
+    return out;
+}
+
+void freefarm(farm* F) {
+    for (u64 i = 0; i < FARMCONNS; ++i) {
+        if (F->cs[i].fd >= 0) close(F->cs[i].fd);
+    }
+    close(F->lfd);
+    if (F->path[0] != '\0') unlink(F->path);
+    free(F->buf);
+    free(F->pend);
+    free(F);
+}
+
+/* Words of the largest frame for genomes of clen nodes */
+static u64 farmwords(u64 clen) {
+    u64 b = FARMBHEAD + FARMBATCH * (FARMIN + clen);
+    u64 r = FARMRHEAD + FARMBATCH * FARMOUT;
+    u64 h = FARMHELLO + MAXROWS;
+    return (b > r) ? ((b > h) ? b : h) : ((r > h) ? r : h);
+}
+
+/* Drop connection i and put its batches back on the queue */
+static void farmdrop(farm* F, u64 i) {
+    farmconn* fc = &F->cs[i];
+    close(fc->fd);
+    fc->fd = -1;
+    for (u64 j = 0; j < fc->nfly; ++j) F->pend[F->npend++] = fc->fly[j];
+    F->redone += fc->nfly;
+    F->nconn--;
+    printf("Worker %lu lost, %lu batches re-dispatched.\n", i, fc->nfly);
+    fc->nfly = 0;
+}
+
+/* Take a waiting worker and greet it with the run's settings */
+static void farmaccept(farm* F, const task* tk) {
+    int fd = accept(F->lfd, NULL, NULL);
+    if (fd < 0) return;
+    u64 i = 0;
+    while (i < FARMCONNS && F->cs[i].fd >= 0) i++;
+    if (i == FARMCONNS) {
+        close(fd);
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { FARMTIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    u64* h = F->buf;
+    h[0] = FARMMAGIC;
+    h[1] = FARMVERSION;
+    h[2] = F->clen;
+    h[3] = FARMBATCH;
+    h[4] = conf.testreps;
+    u32 d;
+    memcpy(&d, &conf.mindel, sizeof(d));
+    h[5] = d;
+    memcpy(&d, &conf.maxdel, sizeof(d));
+    h[6] = d;
+    h[7] = (tk != NULL) ? tk->nrows : 0;
+    for (u64 r = 0; r < h[7]; ++r) {
+        const taskrow* tr = &tk->rows[r];
+        h[FARMHELLO + r] = tr->a | ((u64) tr->b << 8) | ((u64) tr->t << 16) | ((u64) tr->y << 24);
+    }
+    if (farmsend(fd, h, sizeof(u64) * (FARMHELLO + h[7])) != 0) {
+        close(fd);
+        return;
+    }
+    F->cs[i].fd = fd;
+    F->cs[i].nfly = 0;
+    F->nconn++;
+    F->joined++;
+    printf("Worker %lu joined.\n", i);
+}
+
+/* Send batch b of pop[0..n) to connection i */
+static int farmbatch(farm* F, u64 i, u64 b, circ** pop, u64 n, const u64* seed, u64 cut, u64 roll) {
+    u64 lo = b * FARMBATCH;
+    u64 hi = (lo + FARMBATCH < n) ? lo + FARMBATCH : n;
+    u64* f = F->buf;
+    f[0] = (F->run << 32) | b;
+    f[1] = hi - lo;
+    memcpy(f + 2, seed, sizeof(u64) * 4);
+    f[6] = cut;
+    f[7] = roll;
+    u64* p = f + FARMBHEAD;
+    for (u64 j = lo; j < hi; ++j) {
+        const circ* c = pop[j];
+        p[0] = c->energy;
+        p[1] = c->zeros;
+        p[2] = c->rated;
+        memcpy(&p[3], &c->rate, sizeof(u64));
+        memcpy(p + FARMIN, c->code, sizeof(u64) * F->clen);
+        p += FARMIN + F->clen;
+    }
+    return farmsend(F->cs[i].fd, f, sizeof(u64) * (p - f));
+}
+
+/* Take the answer to connection i's oldest batch */
+static int farmresult(farm* F, u64 i, circ** pop, u64 n, i64* res) {
+    farmconn* fc = &F->cs[i];
+    u64* f = F->buf;
+    if (fc->nfly == 0 || farmrecv(fc->fd, f, sizeof(u64) * FARMRHEAD) != 0) return -1;
+    u64 b = fc->fly[0];
+    u64 lo = b * FARMBATCH;
+    u64 hi = (lo + FARMBATCH < n) ? lo + FARMBATCH : n;
+    if (f[0] != ((F->run << 32) | b) || f[1] != hi - lo) return -1;
+    if (farmrecv(fc->fd, f, sizeof(u64) * FARMOUT * (hi - lo)) != 0) return -1;
+
+    const u64* p = f;
+    for (u64 j = lo; j < hi; ++j) {
+        circ* c = pop[j];
+        c->defects = p[0];
+        c->energy = p[1];
+        c->spent = p[2];
+        c->reps = p[3];
+        c->zeros = p[4];
+        c->rated = p[5];
+        memcpy(&c->rate, &p[6], sizeof(u64));
+        res[j] = (i64) p[7];
+        p += FARMOUT;
+    }
+    fc->nfly--;
+    memmove(fc->fly, fc->fly + 1, sizeof(u64) * fc->nfly);
+    /* The next one is queued behind this one, so its clock starts now */
+    fc->due = farmnow() + FARMTIMEOUT;
+    return 0;
+}
+
+/* poolrun() through the workers of F, falling back to p's own threads when
+ * there are none */
+void farmrun(farm* F, evpool* p, circ** pop, u64 n, u64* seed, const task* tk, u64 cut, u64 roll, i64* res) {
+    if (n == 0) return;
+    if (F->buf == NULL) {
+        F->clen = pop[0]->clen;
+        F->buf = (u64*) malloc(sizeof(u64) * farmwords(F->clen));
+        if (F->buf == NULL) {
+            printf("Failed to init farm.\n");
+            exit(-1);
+        }
+    }
+    u64 nb = (n + FARMBATCH - 1) / FARMBATCH;
+    if (nb > F->cap) {
+        free(F->pend);
+        F->cap = nb;
+        F->pend = (u64*) malloc(sizeof(u64) * nb);
+        if (F->pend == NULL) {
+            printf("Failed to init farm.\n");
+            exit(-1);
+        }
+    }
+    /* Popped from the back, so lowest first */
+    for (u64 b = 0; b < nb; ++b) F->pend[b] = nb - 1 - b;
+    F->npend = nb;
+    F->run++;
+    u64 left = nb;
+
+    struct pollfd pf[FARMCONNS + 1];
+    u64 who[FARMCONNS + 1];
+    while (left > 0) {
+        /* Pick up workers that arrived since the last look */
+        pf[0].fd = F->lfd;
+        pf[0].events = POLLIN;
+        while (poll(pf, 1, 0) == 1 && (pf[0].revents & POLLIN)) farmaccept(F, tk);
+
+        if (F->nconn == 0) {
+            while (F->npend > 0) {
+                u64 lo = F->pend[--F->npend] * FARMBATCH;
+                u64 hi = (lo + FARMBATCH < n) ? lo + FARMBATCH : n;
+                poolrun(p, pop + lo, hi - lo, seed, tk, cut, roll, res + lo);
+                left--;
+            }
+            break;
+        }
+
+        /* Top every worker up */
+        for (u64 i = 0; i < FARMCONNS && F->npend > 0; ++i) {
+            farmconn* fc = &F->cs[i];
+            while (fc->fd >= 0 && fc->nfly < FARMDEPTH && F->npend > 0) {
+                u64 b = F->pend[--F->npend];
+                if (fc->nfly == 0) fc->due = farmnow() + FARMTIMEOUT;
+                fc->fly[fc->nfly++] = b;
+                F->sent++;
+                if (farmbatch(F, i, b, pop, n, seed, cut, roll) != 0) farmdrop(F, i);
+            }
+        }
+
+        /* Wait for answers, or new workers, until the nearest deadline */
+        u64 np = 1;
+        f64 due = 0.0;
+        for (u64 i = 0; i < FARMCONNS; ++i) {
+            if (F->cs[i].fd < 0 || F->cs[i].nfly == 0) continue;
+            pf[np].fd = F->cs[i].fd;
+            pf[np].events = POLLIN;
+            who[np] = i;
+            if (np == 1 || F->cs[i].due < due) due = F->cs[i].due;
+            np++;
+        }
+        if (np == 1) continue;
+        f64 wait = due - farmnow();
+        int ms = (wait > 0.0) ? (int) (wait * 1000.0) + 1 : 0;
+        if (poll(pf, np, ms) < 0) {
+            if (errno == EINTR) continue;
+            printf("Failed to wait on workers.\n");
+            exit(-1);
+        }
+        for (u64 k = 1; k < np; ++k) {
+            if (pf[k].revents == 0) continue;
+            if (farmresult(F, who[k], pop, n, res) == 0) {
+                left--;
+            } else {
+                farmdrop(F, who[k]);
+            }
+        }
+
+        /* Connected but stalled */
+        f64 t = farmnow();
+        for (u64 k = 1; k < np; ++k) {
+            farmconn* fc = &F->cs[who[k]];
+            if (fc->fd < 0 || fc->nfly == 0 || t < fc->due) continue;
+            printf("Worker %lu timed out.\n", who[k]);
+            farmdrop(F, who[k]);
+        }
+    }
+}
+
+/* Worker: serve the master at addr until it goes away */
+int farmserve(const char* addr) {
+    int fd = -1;
+    for (u64 k = 0; k < FARMRETRY && (fd = farmsock(addr, 0, NULL)) < 0; ++k) sleep(1);
+    if (fd < 0) {
+        printf("Failed to reach master at %s.\n", addr);
+        return -1;
+    }
+
+    u64 h[FARMHELLO + MAXROWS];
+    if (farmrecv(fd, h, sizeof(u64) * FARMHELLO) != 0 || h[0] != FARMMAGIC || h[1] != FARMVERSION ||
+        h[7] > MAXROWS || farmrecv(fd, h + FARMHELLO, sizeof(u64) * h[7]) != 0) {
+        printf("Master at %s does not speak farm version %d.\n", addr, FARMVERSION);
+        close(fd);
+        return -1;
+    }
+    u64 clen = h[2];
+    u64 nb = h[3];
+    conf.testreps = h[4];
+    u32 d = (u32) h[5];
+    memcpy(&conf.mindel, &d, sizeof(d));
+    d = (u32) h[6];
+    memcpy(&conf.maxdel, &d, sizeof(d));
+    task rt;
+    const task* tk = NULL;
+    if (h[7] > 0) {
+        rt.name = "farm";
+        rt.nrows = h[7];
+        for (u64 r = 0; r < rt.nrows; ++r) {
+            u64 w = h[FARMHELLO + r];
+            rt.rows[r].a = (u8) w;
+            rt.rows[r].b = (u8) (w >> 8);
+            rt.rows[r].t = (u8) (w >> 16);
+            rt.rows[r].y = (u8) (w >> 24);
+        }
+        tk = &rt;
+    }
+
+    evpool* wp = initpool(conf.threads, clen);
+    slab* S = initslab(nb, clen - 5);
+    i64* res = (i64*) malloc(sizeof(i64) * nb);
+    u64* f = (u64*) malloc(sizeof(u64) * farmwords(clen));
+    if (res == NULL || f == NULL) {
+        printf("Failed to init farm worker.\n");
+        exit(-1);
+    }
+    printf("Serving %s with %lu threads.\n", addr, wp->nw);
+    fflush(stdout);
+
+    u64 batches = 0;
+    while (farmrecv(fd, f, sizeof(u64) * FARMBHEAD) == 0) {
+        u64 id = f[0];
+        u64 n = f[1];
+        u64 seed[4];
+        memcpy(seed, f + 2, sizeof(seed));
+        u64 cut = f[6];
+        u64 roll = f[7];
+        if (n == 0 || n > nb || farmrecv(fd, f, sizeof(u64) * n * (FARMIN + clen)) != 0) break;
+
+        const u64* p = f;
+        for (u64 j = 0; j < n; ++j) {
+            circ* c = S->ptr[j];
+            c->energy = p[0];
+            c->zeros = p[1];
+            c->rated = p[2];
+            memcpy(&c->rate, &p[3], sizeof(u64));
+            memcpy(c->code, p + FARMIN, sizeof(u64) * clen);
+            reachcirc(c);
+            p += FARMIN + clen;
+        }
+        poolrun(wp, S->ptr, n, seed, tk, cut, roll, res);
+
+        f[0] = id;
+        f[1] = n;
+        u64* q = f + FARMRHEAD;
+        for (u64 j = 0; j < n; ++j) {
+            const circ* c = S->ptr[j];
+            q[0] = c->defects;
+            q[1] = c->energy;
+            q[2] = c->spent;
+            q[3] = c->reps;
+            q[4] = c->zeros;
+            q[5] = c->rated;
+            memcpy(&q[6], &c->rate, sizeof(u64));
+            q[7] = (u64) res[j];
+            q += FARMOUT;
+        }
+        if (farmsend(fd, f, sizeof(u64) * (q - f)) != 0) break;
+        batches++;
+    }
+    printf("Master went away after %lu batches.\n", batches);
+
+    close(fd);
+    free(f);
+    free(res);
+    freeslab(S);
+    freepool(wp);
+    return 0;
+}
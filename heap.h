@@ -12,7 +12,9 @@ typedef struct {
     u64 cap;
 } sigheap;
 
+/* 4-ary: children of i are (i << DSH) + 1 .. (i << DSH) + D */
 #define D (4)
+#define DSH (2)
 
 sigheap* initheap() {
     sigheap* out = (sigheap*) malloc(sizeof(sigheap));
@@ -34,17 +36,17 @@ void freeheap(sigheap* heap) {
 
 void hfymax(sigheap* heap, u64 i) {
     u64 min = i;
-    for (u64 l = (i << D) + 1; l < (i << D) + D + 1; ++l) {
+    for (u64 l = (i << DSH) + 1; l < (i << DSH) + D + 1; ++l) {
         if (l < heap->n && heap->times[l] > heap->times[min]) min = l;
     }
 
     if (min != i) {
-        f32 tt = heap->times[0];
-        u32 ti = heap->inds[0];
-        f32 tv = heap->vs[0];
-        heap->times[0] = heap->times[min];
-        heap->inds[0] = heap->inds[min];
-        heap->vs[0] = heap->vs[min];
+        f32 tt = heap->times[i];
+        u32 ti = heap->inds[i];
+        f32 tv = heap->vs[i];
+        heap->times[i] = heap->times[min];
+        heap->inds[i] = heap->inds[min];
+        heap->vs[i] = heap->vs[min];
         heap->times[min] = tt;
         heap->inds[min] = ti;
         heap->vs[min] = tv;
@@ -76,14 +78,14 @@ void insmax(sigheap* heap, f32 it, u32 iind, f32 v) {
     }
 
     u64 i = heap->n;
-    u64 pind = (i - 1LU) >> D;
+    u64 pind = (i - 1LU) >> DSH;
 
-    while (i > 0 && heap->times[pind] > it) {
+    while (i > 0 && heap->times[pind] < it) {
         heap->times[i] = heap->times[pind];
         heap->inds[i] = heap->inds[pind];
         heap->vs[i] = heap->vs[pind];
         i = pind;
-        pind = (i - 1LU) >> D;
+        pind = (i - 1LU) >> DSH;
     }
 
     heap->times[i] = it;
@@ -112,22 +114,22 @@ int remmax(sigheap* heap, f32* ot, u32* oind, f32* v) {
 
 void hfymin(sigheap* heap, u64 i) {
     u64 min = i;
-    for (u64 l = (i << D) + 1; l < (i << D) + D + 1; ++l) {
+    for (u64 l = (i << DSH) + 1; l < (i << DSH) + D + 1; ++l) {
         if (l < heap->n && heap->times[l] < heap->times[min]) min = l;
     }
 
     if (min != i) {
-        f32 tt = heap->times[0];
-        u32 ti = heap->inds[0];
-        f32 tv = heap->vs[0];
-        heap->times[0] = heap->times[min];
-        heap->inds[0] = heap->inds[min];
-        heap->vs[0] = heap->vs[min];
+        f32 tt = heap->times[i];
+        u32 ti = heap->inds[i];
+        f32 tv = heap->vs[i];
+        heap->times[i] = heap->times[min];
+        heap->inds[i] = heap->inds[min];
+        heap->vs[i] = heap->vs[min];
         heap->times[min] = tt;
         heap->inds[min] = ti;
         heap->vs[min] = tv;
 
-        hfymax(heap, min);
+        hfymin(heap, min);
     }
 }
 
@@ -154,14 +156,14 @@ void insmin(sigheap* heap, f32 it, u32 iind, f32 v) {
     }
 
     u64 i = heap->n;
-    u64 pind = (i - 1LU) >> D;
+    u64 pind = (i - 1LU) >> DSH;
 
-    while (i > 0 && heap->times[pind] < it) {
+    while (i > 0 && heap->times[pind] > it) {
         heap->times[i] = heap->times[pind];
         heap->inds[i] = heap->inds[pind];
         heap->vs[i] = heap->vs[pind];
         i = pind;
-        pind = (i - 1LU) >> D;
+        pind = (i - 1LU) >> DSH;
     }
 
     heap->times[i] = it;
@@ -186,4 +188,13 @@ int remmin(sigheap* heap, f32* ot, u32* oind, f32* v) {
     hfymin(heap, 0);
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* Warm the lines the next remmin() touches first */
+static inline void hprefetch(const sigheap* heap) {
+    if (heap->n == 0) return;
+    __builtin_prefetch(heap->times);
+    __builtin_prefetch(heap->inds);
+    __builtin_prefetch(heap->vs);
+    __builtin_prefetch(&heap->times[heap->n - 1]);
+}
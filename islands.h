@@ -0,0 +1,234 @@
+#pragma once
+
+#include "types.h"
+#include "conf.h"
+#include "rng.h"
+#include "world.h"
+#include <pthread.h>
+#include <sched.h>
+
+/* Island model.
+ *
+ * conf.islands subpopulations split conf.pop between them. Each is a world
+ * with its own seed (rsubseed) and its own worker pool, and runs the whole
+ * generation loop on its own thread. Every migevery generations each island
+ * sends copies of its migrants best circuits to the next island around a
+ * ring, and replaces its worst with the ones arriving from the previous
+ * island. Migrants travel over lock-free single producer, single consumer
+ * queues.
+ *
+ * Batches are tagged with the generation they leave at, and an island takes
+ * in exactly the batch of its own generation, waiting for it if its
+ * neighbour is behind. A run is therefore still fixed by its seed. */
+
+/* No island has found a solution */
+#define NOISLE (UINT64_MAX)
+
+/* Batches a queue holds before its sender waits */
+#define MIGBATCHES (4)
+
+/* Queue of circuits in slots of words: tag, code, repcode */
+typedef struct {
+    u64 slots;
+    u64 words;
+    u64* buf;
+    /* Written by the sender, read by the receiver, and vice versa */
+    u64 head __attribute__((aligned(64)));
+    u64 tail __attribute__((aligned(64)));
+} migq;
+
+typedef struct archi archi;
+
+typedef struct {
+    archi* A;
+    u64 k;
+    pthread_t thr;
+    world* w;
+    evpool* wp;
+    /* From the previous island, to the next */
+    migq* in;
+    migq* out;
+    /* Scratch for ranking */
+    circ** rank;
+} isle;
+
+struct archi {
+    u64 n;
+    isle* is;
+    migq* qs;
+    u64 every;
+    const volatile int* keep;
+    int stop;
+    u64 solved;
+};
+
+static void initmigq(migq* q, u64 slots, u64 clen) {
+    q->slots = slots;
+    q->words = 1 + 2 * clen;
+    q->buf = (u64*) malloc(sizeof(u64) * q->slots * q->words);
+    if (q->buf == NULL) {
+        printf("Failed to init migration queue.\n");
+        exit(-1);
+    }
+    q->head = 0;
+    q->tail = 0;
+}
+
+static int islestop(const archi* A) {
+    return __atomic_load_n(&A->stop, __ATOMIC_ACQUIRE) || !*A->keep;
+}
+
+/* Send c tagged tag. Returns nonzero if the run stopped while waiting. */
+static int migpush(archi* A, migq* q, const circ* c, u64 tag) {
+    u64 head = q->head;
+    while (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->slots) {
+        if (islestop(A)) return -1;
+        sched_yield();
+    }
+    u64* s = q->buf + (head % q->slots) * q->words;
+    s[0] = tag;
+    memcpy(s + 1, c->code, sizeof(u64) * c->clen);
+    memcpy(s + 1 + c->clen, c->repcode, sizeof(u64) * c->clen);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Receive into c the next circuit, which must be tagged tag. Returns
+ * nonzero if the run stopped while waiting. */
+static int migpop(archi* A, migq* q, circ* c, u64 tag) {
+    u64 tail = q->tail;
+    while (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) {
+        if (islestop(A)) return -1;
+        sched_yield();
+    }
+    const u64* s = q->buf + (tail % q->slots) * q->words;
+    if (s[0] != tag) {
+        printf("Migrant from generation %lu arrived at %lu.\n", s[0], tag);
+        exit(-1);
+    }
+    memcpy(c->code, s + 1, sizeof(u64) * c->clen);
+    memcpy(c->repcode, s + 1 + c->clen, sizeof(u64) * c->clen);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Send the best migrants on, and put the arrivals over the worst as
+ * newborns. Returns nonzero if the run stopped while waiting. */
+static int migrate(isle* I) {
+    world* w = I->w;
+    u64 m = conf.migrants;
+    rankworld(w, I->rank);
+
+    for (u64 i = 0; i < m; ++i) {
+        if (migpush(I->A, I->out, I->rank[i], w->iters) != 0) return -1;
+    }
+    for (u64 i = 0; i < m; ++i) {
+        circ* c = I->rank[w->n - 1 - i];
+        if (migpop(I->A, I->in, c, w->iters) != 0) return -1;
+        c->energy = conf.initenerg;
+        c->born = w->iters;
+        c->zeros = 0;
+        c->rated = 0;
+        hashcirc(c);
+        reachcirc(c);
+    }
+    return 0;
+}
+
+static void* islemain(void* arg) {
+    isle* I = (isle*) arg;
+    archi* A = I->A;
+    world* w = I->w;
+
+    while (!islestop(A) && w->iters != conf.maxiters) {
+        genrec g;
+        int st;
+        PFTIME(PFGEN, st = genstep(w, &g));
+        if (st == GENSOLVED) {
+            u64 none = NOISLE;
+            __atomic_compare_exchange_n(&A->solved, &none, I->k, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&A->stop, 1, __ATOMIC_RELEASE);
+            break;
+        }
+
+        if (g.iter % A->every == 0) {
+            printf("Island %lu iteration %8lu : Pop. %lu , %lu deaths, best %f, runcost %f%s\n",
+                   I->k, g.iter, g.alive, g.deaths, g.best / ((f64) conf.testreps), g.runcost,
+                   (st == GENREGEN) ? ", regenerated" : "");
+        }
+
+        if (A->n > 1 && w->iters % conf.migevery == 0 && migrate(I) != 0) break;
+    }
+    return NULL;
+}
+
+/* Islands for a run seeded with seed on task tk, printing every every
+ * generations and stopping once keep goes to 0 */
+archi* initislands(u64 seed, const task* tk, u64 every, const volatile int* keep) {
+    archi* out = (archi*) malloc(sizeof(archi));
+    if (out == NULL) {
+        printf("Failed to init islands.\n");
+        exit(-1);
+    }
+    out->n = conf.islands;
+    out->is = (isle*) calloc(out->n, sizeof(isle));
+    out->qs = (migq*) calloc(out->n, sizeof(migq));
+    if (out->is == NULL || out->qs == NULL) {
+        printf("Failed to init islands.\n");
+        exit(-1);
+    }
+    out->every = every;
+    out->keep = keep;
+    out->stop = 0;
+    out->solved = NOISLE;
+
+    /* Split the evaluation threads evenly */
+    u64 nw = conf.threads;
+    if (nw == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nw = (ncpu > 0) ? ((u64) ncpu) : 1;
+    }
+    nw = (nw / out->n > 0) ? nw / out->n : 1;
+
+    for (u64 k = 0; k < out->n; ++k) {
+        isle* I = &out->is[k];
+        u64 n = (conf.pop * (k + 1)) / out->n - (conf.pop * k) / out->n;
+        I->A = out;
+        I->k = k;
+        I->wp = initpool(nw, conf.circln + 5);
+        I->w = initworld(n, conf.circln, rsubseed(seed, k), I->wp, tk);
+        I->rank = (circ**) malloc(sizeof(circ*) * n);
+        if (I->rank == NULL) {
+            printf("Failed to init islands.\n");
+            exit(-1);
+        }
+        initmigq(&out->qs[k], conf.migrants * MIGBATCHES, conf.circln + 5);
+        I->out = &out->qs[k];
+        I->in = &out->qs[(k + out->n - 1) % out->n];
+    }
+    return out;
+}
+
+/* Run every island until one finds a solution, all reach maxiters, or keep
+ * goes to 0. Sets A->solved to the island with the solution, if any. */
+void runislands(archi* A) {
+    for (u64 k = 0; k < A->n; ++k) {
+        if (pthread_create(&A->is[k].thr, NULL, islemain, &A->is[k]) != 0) {
+            printf("Failed to start island thread.\n");
+            exit(-1);
+        }
+    }
+    for (u64 k = 0; k < A->n; ++k) pthread_join(A->is[k].thr, NULL);
+}
+
+void freeislands(archi* A) {
+    for (u64 k = 0; k < A->n; ++k) {
+        freeworld(A->is[k].w);
+        freepool(A->is[k].wp);
+        free(A->is[k].rank);
+        free(A->qs[k].buf);
+    }
+    free(A->is);
+    free(A->qs);
+    free(A);
+}
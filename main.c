@@ -2,36 +2,33 @@
 #include <stdlib.h>
 #include <time.h>
 #include <signal.h>
-
-#include "circuit.h"
-
-#define POP (4096)
-#define REPCST (1000)
-#define REPWHEN (1500)
-#define CIRCLN (40)
-
-/* Choose an initial energy such that newborns die off
- * immediately if they don't provide an improvement. If they
- * do manage to be competitive, they may survive, and might also reproduce */
-#define INITENERG (800)
-
-#define COMPTHRESH (512)
-
-#define REW (800)
-#define FEEDINGS (1024)
-#define FDRAT (2)
-#define FDMX (2)
-#define FDSIZE (3)
-
-#define LMUR (0.0f)
-#define MUR (0.3f)
-#define TMUT (0.15f)
-#define BMUT (0.3f)
-
-#define REPRFREQ (0.0f)
-#define REPRSIZE (10)
-
-#define MAXITERS (5000000)
+#include <unistd.h>
+
+#include "world.h"
+#include "islands.h"
+#include "shmisle.h"
+#include "farm.h"
+#include "checkpoint.h"
+#include "telemetry.h"
+#include "metrics.h"
+
+/* Background checkpoint every CKEVERY generations (0 never), and one on
+ * SIGINT. Resume with -r. */
+#define CKEVERY (10000)
+#define CKPATH ("evocirc.ckpt")
+
+/* Binary per-generation record file (see telemetry.h), 0 for none, and the
+ * console summary every PRINTEVERY generations */
+#define TELEM (1)
+#define TELPATH ("evocirc.tlm")
+#define PRINTEVERY (1)
+
+/* Live counters in shared memory under METNAME (see metrics.h), read with
+ * evocirc_mon. 0 publishes nothing. */
+#define METRICS (1)
+
+/* With PROFILE defined (see prof.h), the folded stacks of the whole run */
+#define PROFPATH ("evocirc.folded")
 
 static volatile int keepRunning = 1;
 
@@ -39,253 +36,211 @@ void inthandler(int dummy) {
     keepRunning = 0;
 }
 
-void seedr(u64* state, u64 seed) {
-    state[0] = 0xb6d47cfacccc53f8LU ^ seed;
-    state[1] = 0x30b319a052624be7LU ^ seed;
-    state[2] = 0xfbeb173c6d0227d8LU ^ seed;
-    state[3] = 0x99cfe60a00bdd4feLU ^ seed;
+void fillstate(ckstate* st, const world* w) {
+    st->iters = w->iters;
+    st->seed = w->seed;
+    st->cut = w->cut;
+    st->sg = w->sg;
 }
 
-int main() {
-    u64 rstate[4];
-    seedr(rstate, time(NULL));
-
-    circ** pop = (circ**) malloc(sizeof(circ*) * POP);
-    if (pop == NULL) {
-        printf("Failed to allocate population array.\n");
-        return 0;
+int main(int argc, char** argv) {
+    /* Usage: evocirc [-c config] [-o key=value] [-s seed] [-r checkpoint]
+     * [-j group] [-m addr] [task], or evocirc [-o key=value] -w addr.
+     * Settings (see conf.h) apply in order. The seed defaults to the time; a
+     * checkpoint brings its own. -j joins an island group of processes (see
+     * shmisle.h), whose members each write their checkpoint, telemetry and
+     * metrics page under CKPATH, TELPATH and METNAME suffixed with the group
+     * and their member index. -m farms evaluation out to workers started with -w (see
+     * farm.h). */
+    const char* usage = "Usage: %s [-c config] [-o key=value] [-s seed] [-r checkpoint] [-j group] [-m addr] [task]\n"
+                        "       %s [-c config] [-o key=value] -w addr\n";
+    const char* resume = NULL;
+    const char* group = NULL;
+    const char* master = NULL;
+    const char* worker = NULL;
+    u64 seed = time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:o:s:r:j:m:w:")) != -1) {
+        if (opt == 'c') {
+            loadconf(optarg);
+        } else if (opt == 'o') {
+            if (confset(optarg) != 0) {
+                printf("Bad setting %s\n", optarg);
+                return -1;
+            }
+        } else if (opt == 's') {
+            seed = strtoull(optarg, NULL, 0);
+        } else if (opt == 'r') {
+            resume = optarg;
+        } else if (opt == 'j') {
+            group = optarg;
+        } else if (opt == 'm') {
+            master = optarg;
+        } else if (opt == 'w') {
+            worker = optarg;
+        } else {
+            printf(usage, argv[0], argv[0]);
+            return -1;
+        }
+    }
+    confcheck();
+
+    /* The master sends the task and the settings a run depends on */
+    if (worker != NULL) return farmserve(worker);
+
+    /* Optional task: a built-in name or a task file. Default is TASK. */
+    const task* tk = NULL;
+    if (optind < argc) {
+        tk = findtask(argv[optind]);
+        if (tk == NULL) tk = loadtask(argv[optind]);
+        if (tk == NULL) {
+            printf("Unknown task %s\n", argv[optind]);
+            return -1;
+        }
     }
+    signal(SIGINT, inthandler);
 
-    circ** live = (circ**) malloc(sizeof(circ*) * POP);
-    if (live == NULL) {
-        printf("Failed to allocate living array.\n");
+    if (conf.islands > 1) {
+        /* Islands keep no checkpoints, telemetry or metrics page */
+        if (resume != NULL || group != NULL || master != NULL) {
+            printf("Islands cannot resume from a checkpoint, join a group or farm out.\n");
+            return -1;
+        }
+        printf("Seed %lu.\n", seed);
+        archi* A = initislands(seed, tk, PRINTEVERY, &keepRunning);
+        runislands(A);
+        if (A->solved != NOISLE) {
+            world* w = A->is[A->solved].w;
+            printf("Found solution on iter %lu of island %lu\n", w->iters, A->solved);
+            printcircuit(w->pop[w->solved]);
+        }
+        freeislands(A);
+        pffold(PROFPATH);
         return 0;
     }
 
-    for (u64 i = 0; i < POP; ++i) {
-        pop[i] = initcirc(CIRCLN);
-        randcirc(rstate, pop[i]);
-        pop[i]->energy = INITENERG;
-        pop[i]->born = 0;
+    evpool* wp = initpool(conf.threads, conf.circln + 5);
+    if (master != NULL) wp->fm = initfarm(master);
+    world* w = initworld(conf.pop, conf.circln, seed, wp, tk);
+
+    if (resume != NULL) {
+        ckstate st;
+        ckload(resume, w->S, &st);
+        w->iters = st.iters;
+        w->seed = st.seed;
+        w->cut = st.cut;
+        w->sg = st.sg;
+        printf("Resumed from %s at iteration %lu.\n", resume, w->iters);
     }
-
-    f32* vins = (f32*) calloc((CIRCLN + 5) * 2, sizeof(f32));
-    if (vins == NULL) {
-        printf("Failed to alloc voltage array.\n");
-        return -1;
+    printf("Seed %lu.\n", w->seed);
+    shgroup* gr = (group != NULL) ? shjoin(group, conf.pop, conf.circln + 5) : NULL;
+
+    /* Group members get outputs of their own */
+    char ckpath[4096], telpath[4096], metname[256];
+    snprintf(ckpath, sizeof(ckpath), "%s", CKPATH);
+    snprintf(telpath, sizeof(telpath), "%s", TELPATH);
+    snprintf(metname, sizeof(metname), "%s", METNAME);
+    if (gr != NULL) {
+        shmemname(ckpath, sizeof(ckpath), CKPATH, group, gr->me);
+        shmemname(telpath, sizeof(telpath), TELPATH, group, gr->me);
+        shmemname(metname, sizeof(metname), METNAME, group, gr->me);
+        printf("Joined %s as member %lu.\n", group, gr->me);
     }
-
-    sigheap* h = initheap();
-
-    u64 iters = 0;
-
-    u64 alive = 0;
-    u64 dead = 0;
-    u64 borna = 0;
-    u64 best = UINT64_MAX;
-    u64 worst = 0;
-    f64 avg = 0.0;
-    f64 avglvng = 0.0;
-    f64 avgenrg = 0.0;
-    f64 avglvngenerg = 0.0;
-    u64 generated = 0;
-    u64 mutants = 0;
-    u64 oldest, youngest;
-    u64 maxzers = 0;
-    u64 predead = 0;
-    u64 borns = 0;
-    f64 rncst = 0.0;
+    ckpt ck;
+    initckpt(&ck, ckpath);
+    telem* tl = TELEM ? inittelem(telpath, resume != NULL) : NULL;
+    metrics* mt = METRICS ? initmetrics(metname) : NULL;
 
     while (keepRunning) {
-        f32 iternoise = rf(rstate);
-
-        /* Evaluate all circuits */
-        alive = 0;
-        dead = 0;
-        borna = 0;
-        borns = 0;
-        best = UINT64_MAX;
-        worst = 0;
-        avg = 0.0;
-        avglvng = 0.0;
-        avgenrg = 0.0;
-        avglvngenerg = 0.0;
-        generated = 0;
-        mutants = 0;
-        predead = 0;
-        rncst = 0.0;
+        int show = (w->iters % PRINTEVERY) == 0;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        PFSTART(PFGEN);
+
+        genrec g;
+        int st = genstep(w, &g);
+        if (st == GENSOLVED) {
+            PFSTOP(PFGEN);
+            printf("Found solution on iter %lu\n", w->iters);
+            printcircuit(w->pop[w->solved]);
+            if (tl != NULL) freetelem(tl);
+            if (mt != NULL) freemetrics(mt);
+            if (gr != NULL) shleave(gr);
+            if (wp->fm != NULL) freefarm(wp->fm);
+            pffold(PROFPATH);
+            return 0;
+        }
 
-        oldest = iters;
-        youngest = 0;
-        maxzers = 0;
+        PFSTART(PFPRINT);
+        if (mt != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            f64 secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+            metpublish(mt, g.iter, g.alive, g.best, g.runcost, w->ec->events, poolqpeak(wp), secs);
+        }
+        if (tl != NULL) telpush(tl, &g);
+        if (gr != NULL) {
+            shstats(gr, &g);
+            if (w->iters % conf.migevery == 0) shmigrate(gr, w);
+        }
 
-        for (u64 currCirc = 0; currCirc < POP; ++currCirc) {
-            u64 tstate[4];
-            memcpy(tstate, rstate, sizeof(u64) * 4);
-            // seedr(tstate, 5);
-            /* Same noise for each circ */
-            if (pop[currCirc]->energy == 0) predead++;
-            int res = run(h, tstate, pop[currCirc], vins);
-            rncst += (res / ((f64) POP));
-            if (iters - pop[currCirc]->born > 100) {
-                /* 'Old Age' */
-                pop[currCirc]->energy /= (iters - pop[currCirc]->born) - 100;
+        if (show) {
+            if (st == GENREGEN) printf("Regenerated solution pool.\n");
+            printf("Iteration %8lu : Pop. %lu , %lu deaths, %lu asexual births, %lu sexual births, %lu mutations\n", g.iter, g.alive, g.deaths, g.borna, g.borns, g.mutants);
+            printf("\tBest circuit: %f\n", g.best / ((f64) conf.testreps));
+            printf("\tRuncost: %f\n", g.runcost);
+            printf("\tCache hits: %f\n", g.hits);
+            if (conf.earlyabort) {
+                printf("\tCensored: %f\n", g.censored / ((f64) conf.pop));
             }
-            if (pop[currCirc]->defects < best) best = pop[currCirc]->defects;
-            if (pop[currCirc]->defects > worst) worst = pop[currCirc]->defects;
-
-            if (pop[currCirc]->energy == 0) {
-                dead++;
-            } else {
-                live[alive] = pop[currCirc];
-                alive++;
-                avglvng += ((f64) pop[currCirc]->defects);
-                avglvngenerg += ((f64) pop[currCirc]->energy);
-                if (pop[currCirc]->born > youngest) youngest = pop[currCirc]->born;
-                if (pop[currCirc]->born < oldest) oldest = pop[currCirc]->born;
-                if (pop[currCirc]->zeros > maxzers) maxzers = pop[currCirc]->zeros;
+            if (conf.rollreps) {
+                printf("\tRolled: %f\n", g.rolled / ((f64) conf.pop));
             }
-
-            if (pop[currCirc]->zeros == COMPTHRESH) {
-                printf("Found solution on iter %lu\n", iters);
-                printcircuit(pop[currCirc]);
-                return 0;
+            if (conf.screen) {
+                printf("\tScreened out: %lu\n", g.screened);
             }
-        }
-
-        if (alive) {
-            /* Competition over food */
-            for (u64 fdng = 0; fdng < FEEDINGS; ++fdng) {
-                circ* fdgroup[FDSIZE];
-                /* Pick random sample group */
-                for (u64 i = 0; i < FDSIZE; ++i) {
-                    fdgroup[i] = live[ru(rstate) % alive];
-                }
-
-                /* Bubble sort according to score */
-                u8 swapped = 0;
-                u64 sortn = FDSIZE;
-                do {
-                    swapped = 0;
-                    for (u64 i = 1; i < sortn; ++i) {
-                        if (fdgroup[i - 1]->defects > fdgroup[i]->defects) {
-                            circ* temp = fdgroup[i];
-                            fdgroup[i] = fdgroup[i - 1];
-                            fdgroup[i - 1] = temp;
-                            swapped = 1;
-                        }
-                    }
-                    sortn--;
-                } while (swapped);
-                /* Reward based on configured distribution */
-                u64 curew = REW;
-                u64 curewind = 0;
-                while (curew != 0 && curewind != FDMX) {
-                    fdgroup[curewind]->energy += curew;
-                    curew /= FDRAT;
-                    curewind++;
-                }
+            ssdump();
+            if (g.alive) {
+                printf("\tAvg living circuit: %f\n", g.avglvng / ((f64) conf.testreps));
+                printf("\tAvg living energy: %f\n", g.avgenrg);
+                printf("\tAges: %lu to %lu\n", g.youngest, g.oldest);
+                printf("\tMax zeros: %lu\n", g.maxzers);
             }
+        }
+        PFSTOP(PFPRINT);
+        PFSTOP(PFGEN);
+        /* Covers every generation since the last one shown */
+        if (show) pfdump();
 
-            /* Competition over reproduction */
-            for (u64 currCirc = 0; currCirc < POP; ++currCirc) {
-                /* If not dead, don't try to replace. Maybe mutate. */
-                if (pop[currCirc]->energy != 0) {
-                    if (rf(rstate) < LMUR) {
-                        mutcirc(rstate, pop[currCirc], TMUT, BMUT);
-                        mutants++;
-                        pop[currCirc]->born = iters;
-                    }
-                    continue;
-                }
-
-                circ* reprgroup[REPRSIZE];
-                /* Pick random sample group */
-                for (u64 i = 0; i < REPRSIZE; ++i) {
-                    reprgroup[i] = live[ru(rstate) % alive];
-                }
-
-                /* Bubble sort according to energy */
-                u8 swapped = 0;
-                u64 sortn = FDSIZE;
-                do {
-                    swapped = 0;
-                    for (u64 i = 1; i < sortn; ++i) {
-                        if (reprgroup[i - 1]->defects > reprgroup[i]->defects) {
-                            circ* temp = reprgroup[i];
-                            reprgroup[i] = reprgroup[i - 1];
-                            reprgroup[i - 1] = temp;
-                            swapped = 1;
-                        }
-                    }
-                    sortn--;
-                } while (swapped);
+        if (w->iters == conf.maxiters) break;
 
-                /* If top two have sufficient energy to reproduce,
-                 * breed them and remove energy.
-                 * TODO: If sexes are implemented, different energy costs. */
-                if (reprgroup[0]->energy >= REPWHEN) { //  && rf(rstate) < REPRFREQ
-                    if (rf(rstate) < REPRFREQ && reprgroup[1]->energy >= REPWHEN) { 
-                        crosscirc(rstate, pop[currCirc], reprgroup[0], reprgroup[1]);
-                        reprgroup[0]->energy -= REPCST;
-                        reprgroup[1]->energy -= REPCST;
-                        borns++;
-                    } else {
-                        repcirc(pop[currCirc], reprgroup[0]);
-                        pop[currCirc]->energy = INITENERG;
-                        reprgroup[0]->energy -= REPCST;
-                        borna++;
-                    }
-                    
-                    if (rf(rstate) < MUR) {
-                        mutcirc(rstate, pop[currCirc], TMUT, BMUT);
-                        mutants++;
-                    }
-                    pop[currCirc]->born = iters;
-                } else {
-                    /*
-                    if (alive < POP / 3) {
-                        randcirc(rstate, pop[currCirc]);
-                        pop[currCirc]->energy = INITENERG;
-                        pop[currCirc]->born = iters;
-                        generated++;
-                    }
-                    */
-                }
-            }
-        } else {
-            printf("Regenerated solution pool.\n");
-            for (u64 i = 0; i < POP; ++i) {
-                /* If can't reproduce, generate new */
-                randcirc(rstate, pop[i]);
-                pop[i]->energy = INITENERG;
-                pop[i]->born = iters;
-                generated++;
-            }
+        if (CKEVERY && w->iters % CKEVERY == 0 && keepRunning) {
+            ckstate cs;
+            fillstate(&cs, w);
+            cksnap(&ck, w->S, &cs);
         }
+    }
 
-        printf("Iteration %8lu : Pop. %lu , %lu deaths, %lu asexual births, %lu sexual births, %lu mutations\n", iters, alive, dead - predead, borna, borns, mutants);
-        printf("\tBest circuit: %f\n", best / ((f64) TESTREPS));
-        printf("\tRuncost: %f\n", rncst);
-        if (alive) {
-            printf("\tAvg living circuit: %f\n", ((avglvng) / ((f64) alive)) / ((f64) TESTREPS));
-            printf("\tAvg living energy: %f\n", avglvngenerg / ((f64) alive));
-            printf("\tAges: %lu to %lu\n", iters - youngest, iters - oldest);
-            printf("\tMax zeros: %lu\n", maxzers);
+    ckreap(&ck, 1);
+    if (!keepRunning) {
+        ckstate cs;
+        fillstate(&cs, w);
+        if (cksave(ckpath, w->S, &cs) == 0) {
+            printf("Checkpointed to %s at iteration %lu.\n", ckpath, w->iters);
+        } else {
+            printf("Checkpoint to %s failed.\n", ckpath);
         }
-        
-        iters++;
-        if (iters == MAXITERS) break;
-   }
+    }
 
-    for (u64 i = 0; i < POP; ++i) {
-        free(pop[i]->code);
-        free(pop[i]->repcode);
-        free(pop[i]);
+    pffold(PROFPATH);
+    if (tl != NULL) freetelem(tl);
+    if (mt != NULL) freemetrics(mt);
+    if (gr != NULL) shleave(gr);
+    if (wp->fm != NULL) {
+        printf("Farm: %lu workers joined, %lu batches sent, %lu re-dispatched.\n",
+               wp->fm->joined, wp->fm->sent, wp->fm->redone);
+        freefarm(wp->fm);
     }
-    freeheap(h);
-    free(pop);
-    free(live);
-    free(vins);
+    freeworld(w);
+    freepool(wp);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "types.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Live metrics page.
+ *
+ * The running process publishes its counters to one page of POSIX shared
+ * memory, guarded by a seqlock: the writer makes seq odd, stores the
+ * counters and makes seq even again; a reader copies the page and retries
+ * if seq was odd or moved under it. Writing costs a few stores once per
+ * generation and never waits on readers.
+ *
+ * The page is versioned. Readers must check magic and version before
+ * trusting the layout; any change to it comes with a version bump. */
+
+#define METMAGIC (0x5354454d4f564545LU)
+#define METVERSION (2)
+#define METNAME ("/evocirc")
+
+/* Reader attempts before giving up on a writer that died mid-update */
+#define METSPINS (1000000)
+
+typedef struct {
+    u64 magic;
+    u64 version;
+    u64 pid;
+    /* Odd while an update is in progress */
+    u64 seq;
+
+    u64 iter;
+    u64 alive;
+    /* Best defects, over testreps passes */
+    u64 best;
+    f64 runcost;
+    /* Events simulated last generation per second of its wall time, and
+     * over the run */
+    f64 evps;
+    u64 events;
+    /* Most events one simulation had queued at once, over the run */
+    u64 evqpeak;
+    /* CLOCK_REALTIME of the update, in seconds */
+    f64 stamp;
+} metpage;
+
+/* Writer side */
+typedef struct {
+    char name[256];
+    metpage* pg;
+} metrics;
+
+metrics* initmetrics(const char* name) {
+    metrics* out = (metrics*) malloc(sizeof(metrics));
+    if (out == NULL) {
+        printf("Failed to init metrics.\n");
+        exit(-1);
+    }
+    snprintf(out->name, sizeof(out->name), "%s", name);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(metpage)) != 0) {
+        printf("Failed to create metrics page %s.\n", name);
+        exit(-1);
+    }
+    out->pg = (metpage*) mmap(NULL, sizeof(metpage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (out->pg == MAP_FAILED) {
+        printf("Failed to map metrics page %s.\n", name);
+        exit(-1);
+    }
+
+    metpage* pg = out->pg;
+    __atomic_store_n(&pg->seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(&pg->iter, 0, sizeof(metpage) - offsetof(metpage, iter));
+    pg->magic = METMAGIC;
+    pg->version = METVERSION;
+    pg->pid = getpid();
+    __atomic_store_n(&pg->seq, 2, __ATOMIC_RELEASE);
+    return out;
+}
+
+/* Remove the page; readers that still have it mapped keep the last values */
+void freemetrics(metrics* M) {
+    munmap(M->pg, sizeof(metpage));
+    shm_unlink(M->name);
+    free(M);
+}
+
+void metpublish(metrics* M, u64 iter, u64 alive, u64 best, f64 runcost, u64 events, u64 evqpeak, f64 secs) {
+    metpage* pg = M->pg;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    u64 seq = pg->seq;
+    __atomic_store_n(&pg->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pg->iter = iter;
+    pg->alive = alive;
+    pg->best = best;
+    pg->runcost = runcost;
+    pg->evps = (secs > 0.0) ? events / secs : 0.0;
+    pg->events += events;
+    if (evqpeak > pg->evqpeak) pg->evqpeak = evqpeak;
+    pg->stamp = now.tv_sec + now.tv_nsec * 1e-9;
+    __atomic_store_n(&pg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Reader side. Returns NULL if there is no page under name. */
+const metpage* openmetrics(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    void* pg = mmap(NULL, sizeof(metpage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (pg == MAP_FAILED) ? NULL : (const metpage*) pg;
+}
+
+/* Consistent copy of the page. Returns 0 on success. */
+int metread(const metpage* pg, metpage* out) {
+    for (u64 k = 0; k < METSPINS; ++k) {
+        u64 s0 = __atomic_load_n(&pg->seq, __ATOMIC_ACQUIRE);
+        if (s0 & 1LU) continue;
+        memcpy(out, (const void*) pg, sizeof(metpage));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&pg->seq, __ATOMIC_RELAXED) == s0) return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "shmpage.h"
+
+/* Reader for the live metrics page of a running evocirc (see metrics.h),
+ * or with -j for the members of an island group (see shmpage.h).
+ *
+ * Usage: evocirc_mon [-n name] [-j group] [-i seconds]
+ *
+ * Prints the page once as key=value pairs, or every interval seconds with
+ * -i until the page goes away. name defaults to METNAME. A group prints one
+ * line per member, with the name of its own page for -n, and a last line
+ * over all of them. */
+
+void show(const metpage* m) {
+    printf("pid=%lu iter=%lu alive=%lu best=%lu runcost=%f evps=%.0f events=%lu evqpeak=%lu stamp=%.3f\n",
+           m->pid, m->iter, m->alive, m->best, m->runcost, m->evps, m->events, m->evqpeak, m->stamp);
+    fflush(stdout);
+}
+
+/* Print the live members of a group and their totals. Free entries and
+ * those of dead processes are skipped before reading, since a member killed
+ * mid-update leaves its entry's seqlock held. */
+int showgroup(const char* group, const shmhead* hd) {
+    u64 members = 0;
+    u64 alive = 0;
+    u64 best = UINT64_MAX;
+    u64 sent = 0;
+    u64 taken = 0;
+    u64 iter = 0;
+    for (u64 e = 0; e < SHMMEMBERS; ++e) {
+        u64 pid = __atomic_load_n(&hd->m[e].pid, __ATOMIC_ACQUIRE);
+        if (pid == 0 || shgone(pid)) continue;
+        shmember m;
+        if (shread(hd, e, &m) != 0) {
+            /* Died while we waited */
+            if (shgone(pid)) continue;
+            printf("Island group %s is stuck mid-update.\n", group);
+            return -1;
+        }
+        char page[256];
+        shmemname(page, sizeof(page), METNAME, group, e);
+        printf("member=%lu pid=%lu iter=%lu alive=%lu best=%lu runcost=%f sent=%lu taken=%lu stamp=%.3f page=%s\n",
+               e, m.pid, m.iter, m.alive, m.best, m.runcost, m.sent, m.taken, m.stamp, page);
+        members++;
+        alive += m.alive;
+        best = (m.best < best) ? m.best : best;
+        sent += m.sent;
+        taken += m.taken;
+        iter = (m.iter > iter) ? m.iter : iter;
+    }
+    printf("group=%s members=%lu iter=%lu alive=%lu best=%lu sent=%lu taken=%lu\n",
+           group, members, iter, alive, best, sent, taken);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* name = METNAME;
+    const char* group = NULL;
+    f64 every = 0.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:i:")) != -1) {
+        if (opt == 'n') {
+            name = optarg;
+        } else if (opt == 'j') {
+            group = optarg;
+        } else if (opt == 'i') {
+            every = atof(optarg);
+        } else {
+            printf("Usage: %s [-n name] [-j group] [-i seconds]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (group != NULL) {
+        u64 size;
+        const shmhead* hd = shopen(group, &size);
+        if (hd == NULL || hd->magic != SHMMAGIC || hd->version != SHMVERSION) {
+            printf("No version %d island group %s.\n", SHMVERSION, group);
+            return -1;
+        }
+        while (1) {
+            if (showgroup(group, hd) != 0) return -1;
+            if (every <= 0.0) break;
+            struct timespec ts = { (time_t) every, (long) ((every - (time_t) every) * 1e9) };
+            nanosleep(&ts, NULL);
+        }
+        return 0;
+    }
+
+    const metpage* pg = openmetrics(name);
+    if (pg == NULL) {
+        printf("No metrics page %s.\n", name);
+        return -1;
+    }
+
+    while (1) {
+        metpage m;
+        if (metread(pg, &m) != 0) {
+            printf("Metrics page %s is stuck mid-update.\n", name);
+            return -1;
+        }
+        if (m.magic != METMAGIC || m.version != METVERSION) {
+            printf("%s is not a version %d metrics page.\n", name, METVERSION);
+            return -1;
+        }
+        show(&m);
+        if (every <= 0.0) break;
+
+        struct timespec ts = { (time_t) every, (long) ((every - (time_t) every) * 1e9) };
+        nanosleep(&ts, NULL);
+        /* Stop once the writer has unlinked its page */
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) break;
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "types.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Packed 4-ary min-heap of events.
+ *
+ * Events are 16-byte records in one 64-byte aligned buffer. Node i lives at
+ * slot i + PHOFF, which puts the four children of every node in one cache
+ * line; the smallest child is then picked with a single SIMD compare. */
+
+#define PHOFF (3)
+#define PHINIT (1024)
+
+typedef struct {
+    f32 t;
+    u32 ind;
+    f32 v;
+    u32 pad;
+} phev;
+
+typedef struct {
+    phev* buf;
+    u64 n;
+    u64 cap;
+} pheap;
+
+phev* phalloc(u64 cap) {
+    void* out = NULL;
+    if (posix_memalign(&out, 64, sizeof(phev) * (cap + PHOFF + 1)) != 0) {
+        printf("Failed to alloc packed heap.\n");
+        exit(-1);
+    }
+    return (phev*) out;
+}
+
+pheap* initpheap() {
+    pheap* out = (pheap*) malloc(sizeof(pheap));
+    if (out == NULL) {
+        printf("Failed to init packed heap.\n");
+        exit(-1);
+    }
+    out->n = 0;
+    out->cap = PHINIT;
+    out->buf = phalloc(out->cap);
+    return out;
+}
+
+void freepheap(pheap* h) {
+    free(h->buf);
+    free(h);
+}
+
+void phgrow(pheap* h, u64 need) {
+    if (need <= h->cap) return;
+    u64 cap = h->cap;
+    while (cap < need) cap *= 2;
+    phev* buf = phalloc(cap);
+    memcpy(buf, h->buf, sizeof(phev) * (h->n + PHOFF));
+    free(h->buf);
+    h->buf = buf;
+    h->cap = cap;
+}
+
+static inline void phsiftup(phev* b, u64 i, f32 it, u32 iind, f32 v) {
+    while (i > 0) {
+        u64 p = (i - 1) >> 2;
+        if (!(b[p + PHOFF].t > it)) break;
+        b[i + PHOFF] = b[p + PHOFF];
+        i = p;
+    }
+    b[i + PHOFF].t = it;
+    b[i + PHOFF].ind = iind;
+    b[i + PHOFF].v = v;
+}
+
+void phins(pheap* h, f32 it, u32 iind, f32 v) {
+    phgrow(h, h->n + 1);
+    phsiftup(h->buf, h->n, it, iind, v);
+    h->n++;
+}
+
+/* Two events with the same value, as every gate emits */
+void phins2(pheap* h, f32 t1, u32 i1, f32 t2, u32 i2, f32 v) {
+    phgrow(h, h->n + 2);
+    phsiftup(h->buf, h->n, t1, i1, v);
+    phsiftup(h->buf, h->n + 1, t2, i2, v);
+    h->n += 2;
+}
+
+/* Index of the smallest of the four children starting at node c */
+static inline u64 phmin4(const phev* b, u64 c) {
+#if defined(__SSE2__)
+    const f32* p = (const f32*) &b[c + PHOFF];
+    __m128 r0 = _mm_load_ps(p);
+    __m128 r1 = _mm_load_ps(p + 4);
+    __m128 r2 = _mm_load_ps(p + 8);
+    __m128 r3 = _mm_load_ps(p + 12);
+    /* Gather the four times into one vector */
+    __m128 ts = _mm_movelh_ps(_mm_unpacklo_ps(r0, r1), _mm_unpacklo_ps(r2, r3));
+    __m128 m = _mm_min_ps(ts, _mm_shuffle_ps(ts, ts, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    return c + __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(ts, m)));
+#else
+    u64 m = c;
+    for (u64 l = c + 1; l < c + 4; ++l) {
+        if (b[l + PHOFF].t < b[m + PHOFF].t) m = l;
+    }
+    return m;
+#endif
+}
+
+int phrem(pheap* h, f32* ot, u32* oind, f32* v) {
+    if (h->n == 0) {
+        return -1;
+    }
+
+    phev* b = h->buf;
+    *ot = b[PHOFF].t;
+    *oind = b[PHOFF].ind;
+    *v = b[PHOFF].v;
+    h->n--;
+
+    phev x = b[h->n + PHOFF];
+    u64 n = h->n;
+    u64 i = 0;
+    while (1) {
+        u64 c = (i << 2) + 1;
+        if (c >= n) break;
+
+        u64 m;
+        if (c + 4 <= n) {
+            m = phmin4(b, c);
+        } else {
+            /* Last, partial group */
+            m = c;
+            for (u64 l = c + 1; l < n; ++l) {
+                if (b[l + PHOFF].t < b[m + PHOFF].t) m = l;
+            }
+        }
+
+        if (!(b[m + PHOFF].t < x.t)) break;
+        b[i + PHOFF] = b[m + PHOFF];
+        i = m;
+    }
+    b[i + PHOFF] = x;
+
+    return 0;
+}
+
+/* Warm the lines the next phrem() touches first: the root, its children and
+ * the last event, which is sifted down from the root */
+static inline void phprefetch(const pheap* h) {
+    if (h->n == 0) return;
+    __builtin_prefetch(&h->buf[PHOFF]);
+    __builtin_prefetch(&h->buf[PHOFF + 1]);
+    __builtin_prefetch(&h->buf[h->n - 1 + PHOFF]);
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "types.h"
+#include "evq.h"
+#include "circuit.h"
+#if defined(WEAVE)
+#include "weave.h"
+#endif
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Persistent evaluation workers. Each worker owns its own event queue and
+ * voltage buffer, and is handed a contiguous share of the population per
+ * generation. Shares are drained through an atomic cursor, so a worker that
+ * finishes early steals from the others' shares instead of idling while a
+ * few energy-hungry circuits finish elsewhere.
+ *
+ * With WEAVE defined, slots are claimed WEAVECHUNK at a time and each chunk
+ * is simulated interleaved on the claiming thread (see weave.h). */
+
+/* Circuits per claim in WEAVE mode. Large enough to keep every slot busy
+ * until near the end of a chunk, small enough to steal. */
+#define WEAVECHUNK (WEAVESLOTS * 4)
+
+typedef struct evpool evpool;
+struct farm;
+
+typedef struct {
+    evpool* pool;
+    pthread_t thr;
+    evq* h;
+    simbuf* sb;
+#if defined(WEAVE)
+    weave* W;
+#endif
+    u64 id;
+    /* Next unclaimed slot of this worker's share, and one past its end.
+     * Claimed with an atomic fetch-add by the owner and by thieves alike. */
+    u64 next;
+    u64 end;
+} evworker;
+
+struct evpool {
+    evworker* ws;
+    u64 nw;
+
+    /* Current batch */
+    circ** pop;
+    u64 n;
+    u64* seed;
+    const task* tk;
+    u64 cut;
+    u64 roll;
+    i64* res;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t go;
+    pthread_cond_t done;
+    u64 gen;
+    u64 busy;
+    int quit;
+
+    /* Remote workers that take the evaluation cache's batches instead, if
+     * any (see farm.h) */
+    struct farm* fm;
+};
+
+void poolwork(evworker* w) {
+    evpool* p = w->pool;
+    PFSTART(PFSHARE);
+    for (u64 k = 0; k < p->nw; ++k) {
+        /* Own share first, then walk the others */
+        evworker* v = &p->ws[(w->id + k) % p->nw];
+        u64 i;
+#if defined(WEAVE)
+        while ((i = __atomic_fetch_add(&v->next, (u64) WEAVECHUNK, __ATOMIC_RELAXED)) < v->end) {
+            u64 n = (v->end - i < WEAVECHUNK) ? (v->end - i) : WEAVECHUNK;
+            /* Same noise for each circ */
+            PFTIME(PFRUN, runweave(w->W, p->seed, p->pop + i, n, p->tk, p->cut, p->roll, p->res + i));
+        }
+#else
+        while ((i = __atomic_fetch_add(&v->next, 1LU, __ATOMIC_RELAXED)) < v->end) {
+            u64 tstate[4];
+            /* Same noise for each circ */
+            memcpy(tstate, p->seed, sizeof(u64) * 4);
+            PFTIME(PFRUN, p->res[i] = runtask(w->h, tstate, p->pop[i], w->sb, p->tk, p->cut, p->roll));
+        }
+#endif
+    }
+    PFSTOP(PFSHARE);
+}
+
+void* poolmain(void* arg) {
+    evworker* w = (evworker*) arg;
+    evpool* p = w->pool;
+    u64 seen = 0;
+
+    pthread_mutex_lock(&p->mtx);
+    while (1) {
+        while (p->gen == seen && !p->quit) pthread_cond_wait(&p->go, &p->mtx);
+        if (p->quit) break;
+        seen = p->gen;
+        pthread_mutex_unlock(&p->mtx);
+
+        poolwork(w);
+
+        pthread_mutex_lock(&p->mtx);
+        p->busy--;
+        if (p->busy == 0) pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->mtx);
+
+    return NULL;
+}
+
+evpool* initpool(u64 nw, u64 clen) {
+    if (nw == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nw = (ncpu > 0) ? ((u64) ncpu) : 1;
+    }
+
+    evpool* out = (evpool*) malloc(sizeof(evpool));
+    if (out == NULL) {
+        printf("Failed to init worker pool.\n");
+        exit(-1);
+    }
+    out->nw = nw;
+    out->ws = (evworker*) calloc(nw, sizeof(evworker));
+    if (out->ws == NULL) {
+        printf("Failed to init worker pool.\n");
+        exit(-1);
+    }
+    out->gen = 0;
+    out->busy = 0;
+    out->quit = 0;
+    out->fm = NULL;
+    pthread_mutex_init(&out->mtx, NULL);
+    pthread_cond_init(&out->go, NULL);
+    pthread_cond_init(&out->done, NULL);
+
+    for (u64 i = 0; i < nw; ++i) {
+        evworker* w = &out->ws[i];
+        w->pool = out;
+        w->id = i;
+        w->h = initevq();
+        w->sb = initsimbuf(clen);
+#if defined(WEAVE)
+        w->W = initweave(clen);
+#endif
+        if (pthread_create(&w->thr, NULL, poolmain, w) != 0) {
+            printf("Failed to start worker thread.\n");
+            exit(-1);
+        }
+    }
+
+    return out;
+}
+
+/* Evaluate pop[0..n) on task tk (NULL for the compiled-in task) against a
+ * shared noise seed, aborting runs that fall past cut (NOCUT to score every
+ * pass) and running rated circuits for a slice of roll passes (0 to run
+ * everyone in full). res[i] receives runtask()'s result for pop[i]; results
+ * are written per slot, so any reduction done by the caller in slot order is
+ * independent of the number of workers. */
+void poolrun(evpool* p, circ** pop, u64 n, u64* seed, const task* tk, u64 cut, u64 roll, i64* res) {
+    pthread_mutex_lock(&p->mtx);
+    p->pop = pop;
+    p->n = n;
+    p->seed = seed;
+    p->tk = tk;
+    p->cut = cut;
+    p->roll = roll;
+    p->res = res;
+    for (u64 i = 0; i < p->nw; ++i) {
+        p->ws[i].next = (n * i) / p->nw;
+        p->ws[i].end = (n * (i + 1)) / p->nw;
+    }
+    p->busy = p->nw;
+    p->gen++;
+    pthread_cond_broadcast(&p->go);
+    while (p->busy != 0) pthread_cond_wait(&p->done, &p->mtx);
+    pthread_mutex_unlock(&p->mtx);
+}
+
+/* Most events any worker had queued at once since the last call, which
+ * clears it. Batches run by a farm are not seen. Call between poolrun()s. */
+u64 poolqpeak(evpool* p) {
+    u64 out = 0;
+    for (u64 i = 0; i < p->nw; ++i) {
+        evworker* w = &p->ws[i];
+        if (w->sb->qpeak > out) out = w->sb->qpeak;
+        w->sb->qpeak = 0;
+#if defined(WEAVE)
+        for (u64 k = 0; k < WEAVESLOTS; ++k) {
+            if (w->W->s[k].sb->qpeak > out) out = w->W->s[k].sb->qpeak;
+            w->W->s[k].sb->qpeak = 0;
+        }
+#endif
+    }
+    return out;
+}
+
+void freepool(evpool* p) {
+    pthread_mutex_lock(&p->mtx);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->go);
+    pthread_mutex_unlock(&p->mtx);
+
+    for (u64 i = 0; i < p->nw; ++i) {
+        pthread_join(p->ws[i].thr, NULL);
+        freeevq(p->ws[i].h);
+        freesimbuf(p->ws[i].sb);
+#if defined(WEAVE)
+        freeweave(p->ws[i].W);
+#endif
+    }
+    pthread_mutex_destroy(&p->mtx);
+    pthread_cond_destroy(&p->go);
+    pthread_cond_destroy(&p->done);
+    free(p->ws);
+    free(p);
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include "types.h"
+
+/* Phase profiler.
+ *
+ * Built with PROFILE defined, the generation loop, the workers' shares,
+ * every runtask() and every event queue operation are timed with the TSC.
+ * Scopes form a fixed tree (pfnames). Each thread accumulates into its own
+ * block; the main loop phases and the workers' shares also read hardware
+ * counters (cycles, instructions, cache misses, branch misses) through
+ * perf_event_open() where the kernel allows it, and fall back to TSC only
+ * where it does not.
+ *
+ * pfdump() prints the breakdown since the last dump and adds it to the run
+ * totals; pffold() adds whatever has not been dumped and writes the totals
+ * as folded stacks, ready for flamegraph.pl. Like ssdump(), both may only
+ * run while no worker is simulating.
+ *
+ * Without PROFILE every hook compiles to nothing. */
+
+/* Scopes. Parents come before children. */
+#define PFGEN (0)
+#define PFEVAL (1)
+#define PFFEED (2)
+#define PFREPR (3)
+#define PFPRINT (4)
+#define PFSHARE (5)
+#define PFRUN (6)
+#define PFEVQ (7)
+#define PFN (8)
+
+#if defined(PROFILE)
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define PFHW (4)
+
+static const char* pfnames[PFN] = {
+    "main;generation",
+    "main;generation;evaluate",
+    "main;generation;feeding",
+    "main;generation;reproduce",
+    "main;generation;report",
+    "worker;share",
+    "worker;share;runtask",
+    "worker;share;runtask;evq",
+};
+static const i32 pfparent[PFN] = { -1, PFGEN, PFGEN, PFGEN, PFGEN, -1, PFSHARE, PFRUN };
+/* Scopes that read the hardware counters. The rest are too hot for a
+ * syscall per entry. */
+static const u8 pfhwscope[PFN] = { 0, 1, 1, 1, 1, 1, 0, 0 };
+static const char* pfhwnames[PFHW] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+
+typedef struct pfthread {
+    u64 tsc[PFN];
+    u64 calls[PFN];
+    u64 hw[PFN][PFHW];
+    int fd[PFHW];
+    int hwok;
+    struct pfthread* next;
+} pfthread;
+
+typedef struct {
+    u64 t;
+    u64 hw[PFHW];
+} pfmark;
+
+static pfthread* pfhead = NULL;
+static pthread_mutex_t pfmtx = PTHREAD_MUTEX_INITIALIZER;
+static __thread pfthread* pfmine = NULL;
+/* TSC ticks per microsecond, and run totals */
+static f64 pftpus = 0.0;
+static u64 pftot[PFN];
+static u64 pftothw[PFN][PFHW];
+
+static inline u64 pftsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LU + ts.tv_nsec;
+#endif
+}
+
+static void pfcalib() {
+    struct timespec a, b;
+    struct timespec wait = { 0, 20000000 };
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    u64 t0 = pftsc();
+    nanosleep(&wait, NULL);
+    u64 t1 = pftsc();
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    f64 us = (b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) * 1e-3;
+    pftpus = (t1 - t0) / us;
+}
+
+static void pfopenhw(pfthread* p) {
+    u64 cfg[PFHW] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    p->hwok = 1;
+    for (u64 k = 0; k < PFHW; ++k) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = cfg[k];
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        /* This thread, any CPU */
+        p->fd[k] = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+        if (p->fd[k] < 0) p->hwok = 0;
+    }
+    if (!p->hwok) {
+        for (u64 k = 0; k < PFHW; ++k) {
+            if (p->fd[k] >= 0) close(p->fd[k]);
+        }
+    }
+}
+
+static pfthread* pfreg() {
+    pfthread* out = (pfthread*) calloc(1, sizeof(pfthread));
+    if (out == NULL) {
+        printf("Failed to alloc profiler.\n");
+        exit(-1);
+    }
+    pfopenhw(out);
+    pthread_mutex_lock(&pfmtx);
+    if (pftpus == 0.0) pfcalib();
+    out->next = pfhead;
+    pfhead = out;
+    pthread_mutex_unlock(&pfmtx);
+    return out;
+}
+
+static inline pfthread* pfget() {
+    if (__builtin_expect(pfmine == NULL, 0)) pfmine = pfreg();
+    return pfmine;
+}
+
+static inline void pfreadhw(pfthread* p, u64* out) {
+    for (u64 k = 0; k < PFHW; ++k) {
+        if (read(p->fd[k], &out[k], sizeof(u64)) != sizeof(u64)) out[k] = 0;
+    }
+}
+
+static inline void pfstart(pfmark* m, u32 id) {
+    pfthread* p = pfget();
+    if (pfhwscope[id] && p->hwok) pfreadhw(p, m->hw);
+    m->t = pftsc();
+}
+
+static inline void pfstop(pfmark* m, u32 id) {
+    u64 t = pftsc();
+    pfthread* p = pfget();
+    p->tsc[id] += t - m->t;
+    p->calls[id]++;
+    if (pfhwscope[id] && p->hwok) {
+        u64 hw[PFHW];
+        pfreadhw(p, hw);
+        for (u64 k = 0; k < PFHW; ++k) p->hw[id][k] += hw[k] - m->hw[k];
+    }
+}
+
+#define PFSTART(id) pfmark pfm_##id; pfstart(&pfm_##id, id)
+#define PFSTOP(id) pfstop(&pfm_##id, id)
+/* Time one statement */
+#define PFTIME(id, stmt) do { pfmark pfm_; pfstart(&pfm_, id); stmt; pfstop(&pfm_, id); } while (0)
+
+/* Empty every thread's block into tsc, calls and hw, and add them to the
+ * run totals. Returns whether every thread read the hardware counters. */
+static int pfdrain(u64* tsc, u64* calls, u64 hw[PFN][PFHW]) {
+    int hwok = 1;
+    memset(tsc, 0, sizeof(u64) * PFN);
+    memset(calls, 0, sizeof(u64) * PFN);
+    memset(hw, 0, sizeof(u64) * PFN * PFHW);
+
+    pthread_mutex_lock(&pfmtx);
+    for (pfthread* p = pfhead; p != NULL; p = p->next) {
+        for (u64 i = 0; i < PFN; ++i) {
+            tsc[i] += p->tsc[i];
+            calls[i] += p->calls[i];
+            for (u64 k = 0; k < PFHW; ++k) hw[i][k] += p->hw[i][k];
+        }
+        hwok &= p->hwok;
+        memset(p->tsc, 0, sizeof(p->tsc));
+        memset(p->calls, 0, sizeof(p->calls));
+        memset(p->hw, 0, sizeof(p->hw));
+    }
+    pthread_mutex_unlock(&pfmtx);
+
+    for (u64 i = 0; i < PFN; ++i) {
+        pftot[i] += tsc[i];
+        for (u64 k = 0; k < PFHW; ++k) pftothw[i][k] += hw[i][k];
+    }
+    return hwok;
+}
+
+/* Print the profile since the last dump and add it to the run totals */
+void pfdump() {
+    u64 tsc[PFN], calls[PFN], hw[PFN][PFHW];
+    int hwok = pfdrain(tsc, calls, hw);
+
+    f64 gen = (tsc[PFGEN] > 0) ? ((f64) tsc[PFGEN]) : 1.0;
+    printf("\tProfile: generation %f ms", tsc[PFGEN] / pftpus * 1e-3);
+    for (u64 i = PFEVAL; i <= PFPRINT; ++i) {
+        printf(", %s %.1f%%", strrchr(pfnames[i], ';') + 1, tsc[i] * 100.0 / gen);
+    }
+    printf("\n");
+    printf("\tWorkers: share %f ms, runtask %f ms in %lu calls, evq %f ms in %lu calls\n",
+           tsc[PFSHARE] / pftpus * 1e-3, tsc[PFRUN] / pftpus * 1e-3, calls[PFRUN],
+           tsc[PFEVQ] / pftpus * 1e-3, calls[PFEVQ]);
+    if (!hwok) return;
+    for (u64 i = 0; i < PFN; ++i) {
+        if (!pfhwscope[i] || hw[i][0] == 0) continue;
+        printf("\t%s: IPC %f, %lu cache misses, %lu branch misses\n", strrchr(pfnames[i], ';') + 1,
+               hw[i][1] / ((f64) hw[i][0]), hw[i][2], hw[i][3]);
+    }
+}
+
+/* Write the run totals, with anything not yet dumped, as folded stacks:
+ * self time in microseconds to path, and each hardware counter, where read,
+ * to path.<counter> */
+void pffold(const char* path) {
+    u64 tsc[PFN], calls[PFN], hw[PFN][PFHW];
+    pfdrain(tsc, calls, hw);
+    if (pftpus == 0.0) return;
+
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Failed to open profile %s.\n", path);
+        return;
+    }
+    for (u64 i = 0; i < PFN; ++i) {
+        u64 self = pftot[i];
+        for (u64 j = i + 1; j < PFN; ++j) {
+            if (pfparent[j] == (i32) i) self = (self > pftot[j]) ? self - pftot[j] : 0;
+        }
+        fprintf(f, "%s %lu\n", pfnames[i], (u64) (self / pftpus));
+    }
+    fclose(f);
+
+    /* Counted scopes have no counted children */
+    for (u64 k = 0; k < PFHW; ++k) {
+        u64 any = 0;
+        for (u64 i = 0; i < PFN; ++i) any |= pftothw[i][k];
+        if (any == 0) continue;
+
+        char name[4096];
+        snprintf(name, sizeof(name), "%s.%s", path, pfhwnames[k]);
+        f = fopen(name, "w");
+        if (f == NULL) {
+            printf("Failed to open profile %s.\n", name);
+            continue;
+        }
+        for (u64 i = 0; i < PFN; ++i) {
+            if (pfhwscope[i]) fprintf(f, "%s %lu\n", pfnames[i], pftothw[i][k]);
+        }
+        fclose(f);
+    }
+}
+
+#else
+
+#define PFSTART(id) ((void) 0)
+#define PFSTOP(id) ((void) 0)
+#define PFTIME(id, stmt) do { stmt; } while (0)
+#define pfdump() ((void) 0)
+#define pffold(path) ((void) 0)
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "types.h"
+
+/* Keyed random streams.
+ *
+ * Every draw the evolution loop makes comes from a stream named by (seed,
+ * generation, slot, phase). A stream is the state of the usual generators,
+ * ru() and rf(), filled from Philox4x32-10 blocks with the seed as the key
+ * and the rest of the name as the counter. Streams do not depend on each
+ * other or on the order they are opened in, so a run is fixed by its seed
+ * however the work is split between threads.
+ *
+ * Slots are below 2^32. */
+
+/* Phases */
+#define RNGINIT (0)
+#define RNGEVAL (1)
+#define RNGFEED (2)
+#define RNGREPR (3)
+/* Seeds of sub-runs (see rsubseed) */
+#define RNGSPLIT (4)
+
+#define PHILOXM0 (0xd2511f53U)
+#define PHILOXM1 (0xcd9e8d57U)
+#define PHILOXW0 (0x9e3779b9U)
+#define PHILOXW1 (0xbb67ae85U)
+
+/* Philox4x32-10 of counter c under key k, in place */
+static inline void philox(u32* c, u64 key) {
+    u32 k0 = (u32) key;
+    u32 k1 = (u32) (key >> 32);
+    for (u64 r = 0; r < 10; ++r) {
+        u64 p0 = (u64) PHILOXM0 * c[0];
+        u64 p1 = (u64) PHILOXM1 * c[2];
+        u32 c1 = c[1];
+        u32 c3 = c[3];
+        c[0] = (u32) (p1 >> 32) ^ c1 ^ k0;
+        c[1] = (u32) p1;
+        c[2] = (u32) (p0 >> 32) ^ c3 ^ k1;
+        c[3] = (u32) p0;
+        k0 += PHILOXW0;
+        k1 += PHILOXW1;
+    }
+}
+
+/* Fill the ru()/rf() state st with stream (seed, gen, slot, phase) */
+void rstream(u64* st, u64 seed, u64 gen, u64 slot, u64 phase) {
+    for (u64 b = 0; b < 2; ++b) {
+        u32 c[4] = { (u32) gen, (u32) (gen >> 32), (u32) slot, (u32) ((phase << 1) | b) };
+        philox(c, seed);
+        st[2 * b] = c[0] | ((u64) c[1] << 32);
+        st[2 * b + 1] = c[2] | ((u64) c[3] << 32);
+    }
+    /* rf() steps the low word as an odd multiplicative LCG; it must not
+     * start at zero */
+    st[0] |= 1LU;
+}
+
+/* Seed of independent sub-run k of a run seeded with seed */
+u64 rsubseed(u64 seed, u64 k) {
+    u64 st[4];
+    rstream(st, seed, 0, k, RNGSPLIT);
+    return st[1];
+}
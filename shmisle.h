@@ -0,0 +1,265 @@
+#pragma once
+
+#include "types.h"
+#include "conf.h"
+#include "world.h"
+#include "telemetry.h"
+#include "shmpage.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Multi-process islands.
+ *
+ * Processes that join the same group share one POSIX shared memory segment
+ * holding a table of up to SHMMEMBERS members. Each member owns one table
+ * entry with its stats and a ring of SHMSLOTS emigrant slots. Every
+ * migevery generations a member publishes copies of its migrants best
+ * circuits (code, repcode, energy, defects) into its own ring, then takes
+ * up to migrants circuits that other members published since it last
+ * looked, over its worst, as newborns.
+ *
+ * Nothing waits on anyone else. A ring is only ever written by its owner;
+ * readers check each slot's sequence number before and after copying it and
+ * skip slots that were overwritten under them, so a slow member loses old
+ * emigrants rather than holding up the others. Stats are behind a seqlock
+ * as in metrics.h.
+ *
+ * Joining claims a free entry, or the entry of a member whose process is
+ * gone, with a compare-and-swap on its pid; leaving clears the pid. A
+ * killed member is therefore reclaimed by the next process that joins.
+ * The segment outlives its members; remove it from /dev/shm to reset a
+ * group. All members must run the same circln.
+ *
+ * Members share a working directory and a machine, so each one writes its
+ * checkpoint, telemetry and metrics page under its own name (see
+ * shmemname), which evocirc_mon -j lists.
+ *
+ * The segment's layout and its reader side are in shmpage.h.
+ *
+ * Unlike threaded islands (see islands.h), when emigrants arrive depends on
+ * how fast the processes run, so grouped runs are not fixed by their
+ * seeds. */
+
+typedef struct {
+    shmhead* hd;
+    u64* slots;
+    u64 size;
+    u64 me;
+    u64 pid;
+    /* Scratch: ranks of the population, and one slot */
+    circ** rank;
+    u64* buf;
+    /* Owner and next unread emigrant of every other entry */
+    u64 owner[SHMMEMBERS];
+    u64 next[SHMMEMBERS];
+} shgroup;
+
+static u64 shsize(u64 clen) {
+    return sizeof(shmhead) + sizeof(u64) * SHMMEMBERS * SHMSLOTS * (3 + 2 * clen);
+}
+
+static u64* shslot(const shgroup* G, u64 m, u64 i) {
+    return G->slots + (m * SHMSLOTS + i % SHMSLOTS) * G->hd->words;
+}
+
+/* Map the segment of group name, creating it if it does not exist */
+static shmhead* shmap(const char* name, u64 clen, u64* size) {
+    *size = shsize(clen);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    int created = (fd >= 0);
+    if (!created) fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0 || (created && ftruncate(fd, *size) != 0)) {
+        printf("Failed to open island group %s.\n", name);
+        exit(-1);
+    }
+    struct stat sb;
+    for (u64 k = 0; !created && fstat(fd, &sb) == 0 && (u64) sb.st_size < *size; ++k) {
+        if (k == SHMSPINS || sb.st_size > 0) {
+            printf("Island group %s is not for circln %lu.\n", name, clen - 5);
+            exit(-1);
+        }
+        sched_yield();
+    }
+    shmhead* hd = (shmhead*) mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hd == MAP_FAILED) {
+        printf("Failed to map island group %s.\n", name);
+        exit(-1);
+    }
+
+    if (created) {
+        hd->version = SHMVERSION;
+        hd->clen = clen;
+        hd->words = 3 + 2 * clen;
+        __atomic_store_n(&hd->magic, SHMMAGIC, __ATOMIC_RELEASE);
+    }
+    for (u64 k = 0; __atomic_load_n(&hd->magic, __ATOMIC_ACQUIRE) != SHMMAGIC; ++k) {
+        if (k == SHMSPINS) {
+            printf("%s is not an island group.\n", name);
+            exit(-1);
+        }
+        sched_yield();
+    }
+    if (hd->version != SHMVERSION || hd->clen != clen) {
+        printf("Island group %s is not a version %d group for circln %lu.\n", name, SHMVERSION, clen - 5);
+        exit(-1);
+    }
+    return hd;
+}
+
+/* Join group name with a population of n circuits of clen nodes */
+shgroup* shjoin(const char* name, u64 n, u64 clen) {
+    shgroup* out = (shgroup*) calloc(1, sizeof(shgroup));
+    if (out == NULL) {
+        printf("Failed to join island group.\n");
+        exit(-1);
+    }
+    out->rank = (circ**) malloc(sizeof(circ*) * n);
+    out->buf = (u64*) malloc(sizeof(u64) * 2 * clen);
+    if (out->rank == NULL || out->buf == NULL) {
+        printf("Failed to join island group.\n");
+        exit(-1);
+    }
+    out->hd = shmap(name, clen, &out->size);
+    out->slots = (u64*) (out->hd + 1);
+    out->pid = getpid();
+
+    out->me = SHMMEMBERS;
+    for (u64 pass = 0; pass < 2 && out->me == SHMMEMBERS; ++pass) {
+        for (u64 i = 0; i < SHMMEMBERS; ++i) {
+            u64 pid = __atomic_load_n(&out->hd->m[i].pid, __ATOMIC_ACQUIRE);
+            /* Free entries first, then those of dead members */
+            if (pass == 0 ? pid != 0 : (pid == 0 || !shgone(pid))) continue;
+            if (__atomic_compare_exchange_n(&out->hd->m[i].pid, &pid, out->pid, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                out->me = i;
+                break;
+            }
+        }
+    }
+    if (out->me == SHMMEMBERS) {
+        printf("Island group %s is full.\n", name);
+        exit(-1);
+    }
+
+    shmember* m = &out->hd->m[out->me];
+    u64 seq = m->seq | 1LU;
+    __atomic_store_n(&m->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m->iter = 0;
+    m->alive = 0;
+    m->best = UINT64_MAX;
+    m->runcost = 0.0;
+    m->sent = 0;
+    m->taken = 0;
+    m->stamp = 0.0;
+    __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELEASE);
+    return out;
+}
+
+void shleave(shgroup* G) {
+    __atomic_store_n(&G->hd->m[G->me].pid, 0, __ATOMIC_RELEASE);
+    munmap(G->hd, G->size);
+    free(G->rank);
+    free(G->buf);
+    free(G);
+}
+
+/* Publish this member's stats for generation g */
+void shstats(shgroup* G, const genrec* g) {
+    shmember* m = &G->hd->m[G->me];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    u64 seq = m->seq;
+    __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m->iter = g->iter;
+    m->alive = g->alive;
+    m->best = g->best;
+    m->runcost = g->runcost;
+    m->stamp = now.tv_sec + now.tv_nsec * 1e-9;
+    __atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void shsend(shgroup* G, const circ* c) {
+    shmember* m = &G->hd->m[G->me];
+    u64 i = m->head;
+    u64* s = shslot(G, G->me, i);
+    __atomic_store_n(&s[0], 2 * i + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s[1] = c->energy;
+    s[2] = c->defects;
+    memcpy(s + 3, c->code, sizeof(u64) * c->clen);
+    memcpy(s + 3 + c->clen, c->repcode, sizeof(u64) * c->clen);
+    __atomic_store_n(&s[0], 2 * i + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&m->head, i + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy emigrant i of entry e into c. Returns nonzero, leaving c alone, if
+ * it was overwritten. */
+static int shtake(shgroup* G, u64 e, u64 i, circ* c) {
+    const u64* s = shslot(G, e, i);
+    if (__atomic_load_n(&s[0], __ATOMIC_ACQUIRE) != 2 * i + 2) return -1;
+    u64 defects = s[2];
+    memcpy(G->buf, s + 3, sizeof(u64) * 2 * c->clen);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s[0], __ATOMIC_RELAXED) != 2 * i + 2) return -1;
+
+    c->defects = defects;
+    memcpy(c->code, G->buf, sizeof(u64) * c->clen);
+    memcpy(c->repcode, G->buf + c->clen, sizeof(u64) * c->clen);
+    return 0;
+}
+
+/* Publish the best migrants of w and take up to migrants new emigrants of
+ * the other members over the worst, round robin over members */
+void shmigrate(shgroup* G, world* w) {
+    u64 m = conf.migrants;
+    circ** rank = G->rank;
+    rankworld(w, rank);
+    for (u64 i = 0; i < m; ++i) shsend(G, rank[i]);
+
+    u64 heads[SHMMEMBERS];
+    for (u64 e = 0; e < SHMMEMBERS; ++e) {
+        u64 pid = __atomic_load_n(&G->hd->m[e].pid, __ATOMIC_ACQUIRE);
+        heads[e] = __atomic_load_n(&G->hd->m[e].head, __ATOMIC_ACQUIRE);
+        /* A new owner's emigrants start from its current ring */
+        if (pid != G->owner[e]) {
+            G->owner[e] = pid;
+            G->next[e] = (heads[e] > SHMSLOTS) ? heads[e] - SHMSLOTS : 0;
+        }
+        /* Skip what was overwritten since the last look */
+        if (heads[e] - G->next[e] > SHMSLOTS) G->next[e] = heads[e] - SHMSLOTS;
+    }
+
+    u64 taken = 0;
+    u64 any = 1;
+    while (taken < m && any) {
+        any = 0;
+        for (u64 e = 0; e < SHMMEMBERS && taken < m; ++e) {
+            if (e == G->me || G->owner[e] == 0 || G->next[e] == heads[e]) continue;
+            any = 1;
+            circ* c = rank[w->n - 1 - taken];
+            if (shtake(G, e, G->next[e]++, c) != 0) continue;
+            c->energy = conf.initenerg;
+            c->born = w->iters;
+            c->zeros = 0;
+            c->rated = 0;
+            hashcirc(c);
+            reachcirc(c);
+            taken++;
+        }
+    }
+
+    shmember* me = &G->hd->m[G->me];
+    u64 seq = me->seq;
+    __atomic_store_n(&me->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    me->sent += m;
+    me->taken += taken;
+    __atomic_store_n(&me->seq, seq + 2, __ATOMIC_RELEASE);
+}
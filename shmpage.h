@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Shared segment of an island group (see shmisle.h): the member table that
+ * evocirc_mon reads, and the reader side. Kept apart from the members'
+ * side so a reader needs nothing of the simulator. */
+
+#define SHMMAGIC (0x454c5349564f4545LU)
+#define SHMVERSION (1)
+#define SHMMEMBERS (64)
+#define SHMSLOTS (64)
+
+/* Joiner attempts while the creator initializes the segment */
+#define SHMSPINS (1000000)
+
+/* One cache line pair per member */
+typedef struct {
+    /* Owner, 0 if free */
+    u64 pid __attribute__((aligned(128)));
+    /* Odd while the stats are being updated */
+    u64 seq;
+    u64 iter;
+    u64 alive;
+    u64 best;
+    f64 runcost;
+    u64 sent;
+    u64 taken;
+    /* CLOCK_REALTIME of the update, in seconds */
+    f64 stamp;
+    /* Emigrants published so far; the ring holds the last SHMSLOTS */
+    u64 head;
+} shmember;
+
+typedef struct {
+    u64 magic;
+    u64 version;
+    u64 clen;
+    /* Words per slot: seq, energy, defects, code, repcode */
+    u64 words;
+    shmember m[SHMMEMBERS];
+} shmhead;
+
+/* Whether the process that owns pid is gone */
+static int shgone(u64 pid) {
+    return kill((pid_t) pid, 0) != 0 && errno == ESRCH;
+}
+
+/* Name of member me's copy of output name in group: name.group.me, with
+ * the group's leading '/' dropped */
+void shmemname(char* out, u64 len, const char* name, const char* group, u64 me) {
+    snprintf(out, len, "%s.%s.%lu", name, group + (group[0] == '/'), me);
+}
+
+/* Reader side. Returns NULL if there is no group under name. */
+const shmhead* shopen(const char* name, u64* size) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (u64) sb.st_size < sizeof(shmhead)) {
+        close(fd);
+        return NULL;
+    }
+    *size = sb.st_size;
+    void* hd = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (hd == MAP_FAILED) ? NULL : (const shmhead*) hd;
+}
+
+/* Consistent copy of entry e. Returns 0 on success. */
+int shread(const shmhead* hd, u64 e, shmember* out) {
+    const shmember* m = &hd->m[e];
+    for (u64 k = 0; k < SHMSPINS; ++k) {
+        u64 s0 = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+        if (s0 & 1LU) continue;
+        memcpy(out, (const void*) m, sizeof(shmember));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m->seq, __ATOMIC_RELAXED) == s0) return 0;
+    }
+    return -1;
+}
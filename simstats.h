@@ -0,0 +1,128 @@
+#pragma once
+
+#include "types.h"
+
+/* Simulator counters.
+ *
+ * Built with SIMSTATS defined, the episode kernel and its weave counterpart
+ * count what they do into a per-thread simstats block: episodes, events,
+ * how each episode ended, output node hits, the gate kinds fired, episodes
+ * scored without simulating (see deadpass()), and log2 histograms of events
+ * per episode and of event queue depth after each gate. ssdump() folds
+ * every thread's block into one report and clears them; call it only while
+ * no thread is simulating (between poolrun() calls).
+ *
+ * Without SIMSTATS every hook below compiles to nothing. */
+
+#define SSBUCKETS (32)
+
+#if defined(SIMSTATS)
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct simstats {
+    u64 tests;
+    u64 events;
+    /* Episodes ended by the energy budget rather than a drained queue */
+    u64 starved;
+    u64 outhits;
+    u64 wires;
+    u64 ptype;
+    u64 ntype;
+    u64 dead;
+    u64 qpeak;
+    /* Bucket k counts values in [2^(k-1), 2^k); bucket 0 counts zeros */
+    u64 evhist[SSBUCKETS];
+    u64 qhist[SSBUCKETS];
+
+    struct simstats* next;
+} simstats;
+
+static simstats* sshead = NULL;
+static pthread_mutex_t ssmtx = PTHREAD_MUTEX_INITIALIZER;
+static __thread simstats* ssmine = NULL;
+
+static simstats* ssreg() {
+    simstats* out = (simstats*) calloc(1, sizeof(simstats));
+    if (out == NULL) {
+        printf("Failed to alloc simulator counters.\n");
+        exit(-1);
+    }
+    pthread_mutex_lock(&ssmtx);
+    out->next = sshead;
+    sshead = out;
+    pthread_mutex_unlock(&ssmtx);
+    return out;
+}
+
+static inline simstats* ssget() {
+    if (__builtin_expect(ssmine == NULL, 0)) ssmine = ssreg();
+    return ssmine;
+}
+
+static inline u64 ssbucket(u64 v) {
+    u64 k = (v == 0) ? 0 : 64 - __builtin_clzl(v);
+    return (k < SSBUCKETS) ? k : SSBUCKETS - 1;
+}
+
+#define SSLOCAL simstats* ss_ = ssget()
+#define SSADD(f, n) (ss_->f += (n))
+#define SSINC(f) (ss_->f++)
+#define SSHIST(f, v) (ss_->f[ssbucket(v)]++)
+#define SSMAX(f, v) (ss_->f = ((v) > ss_->f) ? (v) : ss_->f)
+
+static void sshistout(const char* name, const u64* h) {
+    printf("\t%s:", name);
+    for (u64 k = 0; k < SSBUCKETS; ++k) {
+        if (h[k] != 0) printf(" %lu:%lu", (k == 0) ? 0 : (1LU << (k - 1)), h[k]);
+    }
+    printf("\n");
+}
+
+/* Print the counters of every thread since the last dump, then clear them */
+void ssdump() {
+    simstats t;
+    memset(&t, 0, sizeof(t));
+    pthread_mutex_lock(&ssmtx);
+    for (simstats* s = sshead; s != NULL; s = s->next) {
+        t.tests += s->tests;
+        t.events += s->events;
+        t.starved += s->starved;
+        t.outhits += s->outhits;
+        t.wires += s->wires;
+        t.ptype += s->ptype;
+        t.ntype += s->ntype;
+        t.dead += s->dead;
+        if (s->qpeak > t.qpeak) t.qpeak = s->qpeak;
+        for (u64 k = 0; k < SSBUCKETS; ++k) {
+            t.evhist[k] += s->evhist[k];
+            t.qhist[k] += s->qhist[k];
+        }
+        simstats* next = s->next;
+        memset(s, 0, sizeof(simstats));
+        s->next = next;
+    }
+    pthread_mutex_unlock(&ssmtx);
+
+    f64 tests = (t.tests > 0) ? ((f64) t.tests) : 1.0;
+    f64 gates = (t.wires + t.ptype + t.ntype > 0) ? ((f64) (t.wires + t.ptype + t.ntype)) : 1.0;
+    printf("\tSim: %lu tests, %f events/test, %f starved, %f output hits/test, queue peak %lu, %lu dead\n",
+           t.tests, t.events / tests, t.starved / tests, t.outhits / tests, t.qpeak, t.dead);
+    printf("\tGates: %f wire, %f P, %f N\n", t.wires / gates, t.ptype / gates, t.ntype / gates);
+    sshistout("Events/test", t.evhist);
+    sshistout("Queue depth", t.qhist);
+}
+
+#else
+
+#define SSLOCAL ((void) 0)
+#define SSADD(f, n) ((void) 0)
+#define SSINC(f) ((void) 0)
+#define SSHIST(f, v) ((void) 0)
+#define SSMAX(f, v) ((void) 0)
+#define ssdump() ((void) 0)
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "types.h"
+#include "circuit.h"
+#include <string.h>
+
+/* Population store.
+ *
+ * All circuits of a population live in a handful of allocations, indexed by
+ * slot: the circ headers in one array, every genome's code in one 64-byte
+ * aligned slab, and the repcodes, which are only read on reproduction, in
+ * another. Each genome starts on a cache line. ptr[] is the usual circ**
+ * view of the headers for the evaluation code.
+ *
+ * The fields the generation scans read (energy, defects, born, zeros) are
+ * also kept in parallel arrays. They are copies, not the storage:
+ * slabgather() refreshes them from the headers once the headers are final
+ * for the generation, and only the scans that run after it (the generation
+ * stats and the solution check) read them. Feeding and reproduction change
+ * the headers through circ*, and tournaments compare defects there too, so
+ * the arrays go stale as soon as a generation's food is handed out. */
+
+typedef struct {
+    u64 n;
+    u64 clen;
+    /* Words per genome in the slabs */
+    u64 stride;
+
+    circ* circs;
+    circ** ptr;
+    u64* code;
+    u64* repcode;
+
+    u64* energy;
+    u64* defects;
+    u64* born;
+    u64* zeros;
+} slab;
+
+static u64* slaballoc(u64 words) {
+    void* out = NULL;
+    if (posix_memalign(&out, 64, sizeof(u64) * words) != 0) {
+        printf("Failed to init population slab.\n");
+        exit(-1);
+    }
+    return (u64*) out;
+}
+
+/* Refresh the parallel arrays from the headers */
+void slabgather(slab* S) {
+    for (u64 i = 0; i < S->n; ++i) {
+        const circ* c = &S->circs[i];
+        S->energy[i] = c->energy;
+        S->defects[i] = c->defects;
+        S->born[i] = c->born;
+        S->zeros[i] = c->zeros;
+    }
+}
+
+/* n circuits of len + 5 nodes, set up as by initcirc() */
+slab* initslab(u64 n, u64 len) {
+    slab* out = (slab*) malloc(sizeof(slab));
+    if (out == NULL) {
+        printf("Failed to init population slab.\n");
+        exit(-1);
+    }
+    out->n = n;
+    out->clen = len + 5;
+    out->stride = (out->clen + 7) & ~7LU;
+
+    out->circs = (circ*) malloc(sizeof(circ) * n);
+    out->ptr = (circ**) malloc(sizeof(circ*) * n);
+    if (out->circs == NULL || out->ptr == NULL) {
+        printf("Failed to init population slab.\n");
+        exit(-1);
+    }
+    out->code = slaballoc(n * out->stride);
+    out->repcode = slaballoc(n * out->stride);
+    out->energy = slaballoc(n);
+    out->defects = slaballoc(n);
+    out->born = slaballoc(n);
+    out->zeros = slaballoc(n);
+    memset(out->code, 0, sizeof(u64) * n * out->stride);
+    memset(out->repcode, 0, sizeof(u64) * n * out->stride);
+
+    for (u64 i = 0; i < n; ++i) {
+        placecirc(&out->circs[i], len, out->code + i * out->stride, out->repcode + i * out->stride);
+        out->ptr[i] = &out->circs[i];
+    }
+    return out;
+}
+
+void freeslab(slab* S) {
+    free(S->circs);
+    free(S->ptr);
+    free(S->code);
+    free(S->repcode);
+    free(S->energy);
+    free(S->defects);
+    free(S->born);
+    free(S->zeros);
+    free(S);
+}
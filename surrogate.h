@@ -0,0 +1,117 @@
+#pragma once
+
+#include "types.h"
+#include "circuit.h"
+#include <string.h>
+
+/* Surrogate fitness model for pre-screening offspring.
+ *
+ * A linear model over a few structural features of a circuit's phenotype
+ * predicts its defects per pass. It is trained online (normalized LMS) on
+ * every fully scored circuit, and tracks its own mean squared error. An
+ * offspring is rejected only when the prediction is past the limit by more
+ * than SURRZ root mean squared errors; anything closer is left to the
+ * simulator. */
+
+#define NFEAT (11)
+
+/* Step size, and the weight of each new squared error in mse */
+#define SURRMU (0.05)
+#define SURRMSEW (0.01)
+
+/* Samples before the model is trusted */
+#define SURRMIN (4096)
+
+/* Rejection margin, in root mean squared errors */
+#define SURRZ (3.0)
+
+typedef struct {
+    f64 w[NFEAT];
+    f64 mse;
+    u64 n;
+} surr;
+
+void initsurr(surr* s) {
+    memset(s->w, 0, sizeof(s->w));
+    s->mse = 0.0;
+    s->n = 0;
+}
+
+/* Features of c's phenotype. Edge counts cover the taps and every reachable
+ * gate, two targets each. */
+void featcirc(const circ* c, f64* f) {
+    u64 clen = c->clen;
+    u64 ph[clen];
+    phenocirc(c, ph);
+
+    u64 gates = 0, wires = 0, ptype = 0, self = 0;
+    u64 edges = 0, todata = 0, tocomp = 0, tosel = 0, tapout = 0;
+    for (u64 j = 0; j < clen; ++j) {
+        /* Unreached gates are zero in the phenotype; taps always count */
+        if (j >= 4 && ph[j] == 0) continue;
+        if (j == 4 || j == 5) continue;
+        if (j >= 6) {
+            gates++;
+            if (ph[j] & 0b10LU) {
+                wires++;
+            } else if (ph[j] & 1LU) {
+                ptype++;
+            }
+        }
+
+        u64 t[2] = { (ph[j] >> 2U) & ((1U << 31U) - 1U), ph[j] >> 33U };
+        for (u64 k = 0; k < 2; ++k) {
+            u64 tind = t[k] % clen;
+            if (tind < 4) tind += 4;
+            edges++;
+            if (t[k] >= clen) tosel++;
+            if (tind == j) self++;
+            if (tind == 4) todata++;
+            if (tind == 5) tocomp++;
+            if (j < 4 && tind < 6) tapout++;
+        }
+    }
+
+    f64 ng = (gates > 0) ? ((f64) gates) : 1.0;
+    f[0] = 1.0;
+    f[1] = gates / ((f64) (clen - 6));
+    f[2] = wires / ng;
+    f[3] = ptype / ng;
+    f[4] = todata / ((f64) edges);
+    f[5] = tocomp / ((f64) edges);
+    f[6] = tosel / ((f64) edges);
+    f[7] = tapout / 8.0;
+    f[8] = self / ((f64) edges);
+    f[9] = (todata > 0) ? 1.0 : 0.0;
+    f[10] = (tocomp > 0) ? 1.0 : 0.0;
+}
+
+f64 surrpredict(const surr* s, const f64* f) {
+    f64 y = 0.0;
+    for (u64 i = 0; i < NFEAT; ++i) y += s->w[i] * f[i];
+    return y;
+}
+
+/* Learn from a circuit scored in full */
+void surrtrain(surr* s, const circ* c) {
+    f64 f[NFEAT];
+    featcirc(c, f);
+
+    f64 err = c->defects / ((f64) conf.testreps) - surrpredict(s, f);
+    f64 nrm = 1e-9;
+    for (u64 i = 0; i < NFEAT; ++i) nrm += f[i] * f[i];
+    for (u64 i = 0; i < NFEAT; ++i) s->w[i] += SURRMU * err * f[i] / nrm;
+
+    s->mse += SURRMSEW * (err * err - s->mse);
+    s->n++;
+}
+
+/* Whether c is confidently worse than limit (defects over a full run) */
+int surrreject(const surr* s, const circ* c, u64 limit) {
+    if (s->n < SURRMIN) return 0;
+
+    f64 f[NFEAT];
+    featcirc(c, f);
+    f64 d = surrpredict(s, f) - limit / ((f64) conf.testreps);
+    return d > 0.0 && d * d > SURRZ * SURRZ * s->mse;
+}
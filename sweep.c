@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "world.h"
+#include "telemetry.h"
+
+/* Parameter sweeps. Runs many experiments, each a single population with
+ * its own settings and seed, in one process on one shared worker pool.
+ *
+ * Usage: evocirc_sweep [-c config] [-o key=value] [-s seed] [-d dir]
+ * sweepfile [task]
+ *
+ * -c and -o set the base settings, and -s the seed of experiments that do
+ * not sweep it (default the time). Each line of the sweep file is either
+ *
+ *   key = v1, v2, ...     an axis: every experiment is run at each value
+ *   exp key=v key=v ...   one point of a list
+ *
+ * Experiments are every exp line (or the base alone, if there are none)
+ * crossed with every value of every axis; exp settings apply over the axes.
+ * seed may be an axis or an exp setting like any conf key. '#' starts a
+ * comment.
+ *
+ * Up to SWEEPLIVE experiments evolve at once. The next generation always
+ * goes to the live experiment that has had the least pool time so far, so
+ * cheap settings do not starve behind expensive ones. Each experiment
+ * stops at its maxiters or on a solution, and writes its telemetry (see
+ * telemetry.h) to dir/expNNNN.tlm. dir/sweep.txt gets one line per
+ * finished experiment with its settings, the generation it was solved on
+ * (-1 if not) and its pool time.
+ *
+ * The pool is built once, so circln, threads and the delay range its event
+ * queues are sized for (mindel, maxdel) are fixed for the whole sweep, and
+ * islands must stay 1. */
+
+/* Experiments evolving at once */
+#define SWEEPLIVE (8)
+
+#define SWEEPMAX (4096)
+#define SWEEPAXES (16)
+#define SWEEPVALS (64)
+#define SWEEPEXPS (256)
+
+/* Longest key=value, and the settings of one experiment */
+#define SWEEPKV (64)
+#define SWEEPDESC (1024)
+
+#define SWEEPDIR (".")
+#define SWEEPOUT ("sweep.txt")
+/* With PROFILE defined (see prof.h), the folded stacks of the whole sweep */
+#define SWEEPPROF ("sweep.folded")
+
+typedef struct {
+    char key[SWEEPKV];
+    u64 n;
+    char vals[SWEEPVALS][SWEEPKV];
+} axis;
+
+typedef struct {
+    u64 n;
+    char kvs[SWEEPAXES][SWEEPKV];
+} point;
+
+typedef struct {
+    u64 id;
+    config cf;
+    u64 seed;
+    char desc[SWEEPDESC];
+
+    world* w;
+    telem* tl;
+    /* Seconds spent in genstep() */
+    f64 secs;
+} experiment;
+
+static volatile int keepRunning = 1;
+
+void inthandler(int dummy) {
+    keepRunning = 0;
+}
+
+/* Apply key=value to conf or to seed. Returns 0 on success. */
+static int sweepset(const char* kv, u64* seed) {
+    if (strncmp(kv, "seed=", 5) == 0) {
+        char* end;
+        *seed = strtoull(kv + 5, &end, 0);
+        return (end != kv + 5 && *end == '\0') ? 0 : -1;
+    }
+    return confset(kv);
+}
+
+/* Read the axes and exp lines of path, checking every setting against the
+ * base */
+static void loadsweep(const char* path, axis* ax, u64* nax, point* pt, u64* npt) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Failed to open sweep %s.\n", path);
+        exit(-1);
+    }
+    config base = conf;
+    u64 seed = 0;
+    char line[1024];
+    u64 lnum = 0;
+    *nax = 0;
+    *npt = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lnum++;
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        char* s = line + strspn(line, " \t\r\n");
+        if (*s == '\0') continue;
+
+        int bad = 0;
+        if (strncmp(s, "exp", 3) == 0 && (s[3] == ' ' || s[3] == '\t')) {
+            if (*npt == SWEEPEXPS) bad = 1;
+            point* p = &pt[*npt];
+            p->n = 0;
+            for (char* t = strtok(s + 3, " \t\r\n"); t != NULL && !bad; t = strtok(NULL, " \t\r\n")) {
+                bad = p->n == SWEEPAXES || strlen(t) >= SWEEPKV || sweepset(t, &seed) != 0;
+                if (!bad) strcpy(p->kvs[p->n++], t);
+            }
+            if (!bad) (*npt)++;
+        } else {
+            /* Squeeze out whitespace, then split key = v1, v2, ... */
+            char kv[1024];
+            u64 n = 0;
+            for (char* p = s; *p != '\0'; ++p) {
+                if (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') kv[n++] = *p;
+            }
+            kv[n] = '\0';
+            char* eq = strchr(kv, '=');
+            if (*nax == SWEEPAXES || eq == NULL || eq == kv || (u64) (eq - kv) >= SWEEPKV) bad = 1;
+            axis* a = &ax[*nax];
+            if (!bad) {
+                *eq = '\0';
+                strcpy(a->key, kv);
+                a->n = 0;
+            }
+            for (char* v = bad ? NULL : strtok(eq + 1, ","); v != NULL && !bad; v = strtok(NULL, ",")) {
+                char one[SWEEPKV];
+                bad = a->n == SWEEPVALS || snprintf(one, sizeof(one), "%s=%s", a->key, v) >= (int) sizeof(one);
+                if (bad) break;
+                bad = sweepset(one, &seed) != 0;
+                if (!bad) strcpy(a->vals[a->n++], one);
+            }
+            if (!bad && a->n == 0) bad = 1;
+            if (!bad) (*nax)++;
+        }
+        if (bad) {
+            printf("%s:%lu: bad sweep line\n", path, lnum);
+            exit(-1);
+        }
+    }
+    fclose(f);
+    conf = base;
+}
+
+/* Settings of experiment k of the sweep */
+static void mkexp(experiment* E, u64 k, const config* base, u64 seed,
+                  const axis* ax, u64 nax, const point* pt, u64 npt) {
+    E->id = k;
+    E->seed = seed;
+    E->desc[0] = '\0';
+    E->w = NULL;
+    E->tl = NULL;
+    E->secs = 0.0;
+    conf = *base;
+
+    /* Mixed radix over the axes, last fastest, then the exp lines */
+    const char* kvs[SWEEPAXES * 2];
+    u64 nkv = 0;
+    u64 r = k;
+    u64 digit[SWEEPAXES];
+    for (u64 a = nax; a-- > 0;) {
+        digit[a] = r % ax[a].n;
+        r /= ax[a].n;
+    }
+    for (u64 a = 0; a < nax; ++a) kvs[nkv++] = ax[a].vals[digit[a]];
+    if (npt > 0) {
+        for (u64 i = 0; i < pt[r].n; ++i) kvs[nkv++] = pt[r].kvs[i];
+    }
+
+    for (u64 i = 0; i < nkv; ++i) {
+        sweepset(kvs[i], &E->seed);
+        if (strncmp(kvs[i], "seed=", 5) != 0 && strlen(E->desc) + strlen(kvs[i]) + 2 < SWEEPDESC) {
+            if (E->desc[0] != '\0') strcat(E->desc, " ");
+            strcat(E->desc, kvs[i]);
+        }
+    }
+    printf("Experiment %lu: %s seed=%lu\n", k, E->desc, E->seed);
+    confcheck();
+    if (conf.circln != base->circln || conf.threads != base->threads || conf.islands != 1 ||
+        conf.mindel != base->mindel || conf.maxdel != base->maxdel) {
+        printf("Experiment %lu (%s) changes circln, threads, islands, mindel or maxdel.\n", k, E->desc);
+        exit(-1);
+    }
+    E->cf = conf;
+}
+
+/* Close experiment E and record it in out; solved is -1 if it was not */
+static void endexp(experiment* E, FILE* out, i64 solved) {
+    fprintf(out, "exp=%lu %s seed=%lu solved=%ld iters=%lu secs=%.3f\n",
+            E->id, E->desc, E->seed, solved, E->w->iters, E->secs);
+    fflush(out);
+    freetelem(E->tl);
+    freeworld(E->w);
+    E->w = NULL;
+}
+
+int main(int argc, char** argv) {
+    const char* usage = "Usage: %s [-c config] [-o key=value] [-s seed] [-d dir] sweepfile [task]\n";
+    const char* dir = SWEEPDIR;
+    u64 seed = time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:o:s:d:")) != -1) {
+        if (opt == 'c') {
+            loadconf(optarg);
+        } else if (opt == 'o') {
+            if (confset(optarg) != 0) {
+                printf("Bad setting %s\n", optarg);
+                return -1;
+            }
+        } else if (opt == 's') {
+            seed = strtoull(optarg, NULL, 0);
+        } else if (opt == 'd') {
+            dir = optarg;
+        } else {
+            printf(usage, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc) {
+        printf(usage, argv[0]);
+        return -1;
+    }
+    confcheck();
+
+    const task* tk = NULL;
+    if (optind + 1 < argc) {
+        tk = findtask(argv[optind + 1]);
+        if (tk == NULL) tk = loadtask(argv[optind + 1]);
+        if (tk == NULL) {
+            printf("Unknown task %s\n", argv[optind + 1]);
+            return -1;
+        }
+    }
+
+    static axis ax[SWEEPAXES];
+    static point pt[SWEEPEXPS];
+    u64 nax, npt;
+    loadsweep(argv[optind], ax, &nax, pt, &npt);
+
+    u64 n = (npt > 0) ? npt : 1;
+    for (u64 a = 0; a < nax; ++a) {
+        if (n * ax[a].n > SWEEPMAX) {
+            printf("Sweep has over %d experiments.\n", SWEEPMAX);
+            return -1;
+        }
+        n *= ax[a].n;
+    }
+
+    config base = conf;
+    experiment* es = (experiment*) malloc(sizeof(experiment) * n);
+    if (es == NULL) {
+        printf("Failed to init sweep.\n");
+        return -1;
+    }
+    for (u64 k = 0; k < n; ++k) {
+        mkexp(&es[k], k, &base, seed, ax, nax, pt, npt);
+    }
+    conf = base;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create %s.\n", dir);
+        return -1;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, SWEEPOUT);
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Failed to open %s.\n", path);
+        return -1;
+    }
+
+    signal(SIGINT, inthandler);
+    evpool* wp = initpool(base.threads, base.circln + 5);
+
+    experiment* live[SWEEPLIVE];
+    u64 nlive = 0;
+    u64 next = 0;
+    while (keepRunning && (nlive > 0 || next < n)) {
+        while (nlive < SWEEPLIVE && next < n) {
+            experiment* E = &es[next++];
+            conf = E->cf;
+            E->w = initworld(conf.pop, conf.circln, E->seed, wp, tk);
+            snprintf(path, sizeof(path), "%s/exp%04lu.tlm", dir, E->id);
+            E->tl = inittelem(path, 0);
+            live[nlive++] = E;
+        }
+
+        /* Least pool time first; ties go to the oldest */
+        u64 j = 0;
+        for (u64 i = 1; i < nlive; ++i) {
+            if (live[i]->secs < live[j]->secs) j = i;
+        }
+        experiment* E = live[j];
+        conf = E->cf;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        genrec g;
+        int st;
+        PFTIME(PFGEN, st = genstep(E->w, &g));
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        E->secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        /* A solving step returns before it fills g, as in evocirc */
+        if (st != GENSOLVED) telpush(E->tl, &g);
+
+        if (st == GENSOLVED || E->w->iters == conf.maxiters) {
+            if (st == GENSOLVED) {
+                printf("Experiment %lu: Found solution on iter %lu after %.3f s\n", E->id, E->w->iters, E->secs);
+                printcircuit(E->w->pop[E->w->solved]);
+            } else {
+                printf("Experiment %lu: No solution in %lu iters after %.3f s\n", E->id, E->w->iters, E->secs);
+            }
+            endexp(E, out, (st == GENSOLVED) ? (i64) E->w->iters : -1);
+            memmove(live + j, live + j + 1, sizeof(experiment*) * (--nlive - j));
+        }
+    }
+
+    /* Interrupted: record how far the live ones got */
+    for (u64 i = 0; i < nlive; ++i) endexp(live[i], out, -1);
+    if (!keepRunning) printf("Stopped with %lu experiments not started.\n", n - next);
+
+    fclose(out);
+    freepool(wp);
+    snprintf(path, sizeof(path), "%s/%s", dir, SWEEPPROF);
+    pffold(path);
+    free(es);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Task specifications.
+ *
+ * A task is a truth table for an asynchronous gate with two data inputs
+ * A and B, a request input t, and two outputs: data (node 4) and
+ * complete (node 5). Every row is one test episode. P (power, code[3]) is
+ * always driven HI.
+ *
+ * Rows with t HI are requests: complete must eventually go HI, and while it
+ * is HI the data output must match y (unless y is YX). Rows with t LO are
+ * idle: complete must stay LO ("x 0"), data is don't-care.
+ *
+ * Lo: 0.0 - 0.3
+ *  ∅: 0.3 - 0.7
+ * Hi: 0.7 - 1.0 */
+
+/* Levels driven onto input taps */
+#define LO (0.1f)
+#define HI (1.f)
+
+/* Expected data output */
+#define Y0 (0)
+#define Y1 (1)
+#define YX (2)
+
+/* A wrong data output while complete is HI */
+#define GLITCHW (2)
+
+#define MAXROWS (16)
+
+typedef struct {
+    u8 a;
+    u8 b;
+    u8 t;
+    u8 y;
+} taskrow;
+
+typedef struct {
+    const char* name;
+    u64 nrows;
+    taskrow rows[MAXROWS];
+} task;
+
+/* Built-in tasks as X-macros, X(a, b, t, y). The fixed task (TASK) is
+ * expanded directly into run() so its rows are compile-time constants;
+ * the same lists also back the runtime tables below. */
+
+/* Async AND gate
+ * 0: 0 0 1 -> 0 1 or x 0
+ * 1: 0 1 1 -> 0 1 or x 0
+ * 2: 1 0 1 -> 0 1 or x 0
+ * 3: 1 1 1 -> 1 1 or x 0
+ * 4: 0 0 0 -> x 0
+ * 5: 0 1 0 -> x 0
+ * 6: 1 0 0 -> x 0
+ * 7: 1 1 0 -> x 0 */
+#define TASK_AND(X) \
+    X(0, 0, 1, Y0) X(0, 1, 1, Y0) X(1, 0, 1, Y0) X(1, 1, 1, Y1) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+#define TASK_OR(X) \
+    X(0, 0, 1, Y0) X(0, 1, 1, Y1) X(1, 0, 1, Y1) X(1, 1, 1, Y1) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+#define TASK_NAND(X) \
+    X(0, 0, 1, Y1) X(0, 1, 1, Y1) X(1, 0, 1, Y1) X(1, 1, 1, Y0) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+#define TASK_NOR(X) \
+    X(0, 0, 1, Y1) X(0, 1, 1, Y0) X(1, 0, 1, Y0) X(1, 1, 1, Y0) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+#define TASK_XOR(X) \
+    X(0, 0, 1, Y0) X(0, 1, 1, Y1) X(1, 0, 1, Y1) X(1, 1, 1, Y0) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+#define TASK_XNOR(X) \
+    X(0, 0, 1, Y1) X(0, 1, 1, Y0) X(1, 0, 1, Y0) X(1, 1, 1, Y1) \
+    X(0, 0, 0, YX) X(0, 1, 0, YX) X(1, 0, 0, YX) X(1, 1, 0, YX)
+
+/* Task compiled into run() */
+#ifndef TASK
+#define TASK TASK_AND
+#endif
+
+#define TASKROW(a, b, t, y) { a, b, t, y },
+#define TASKROWS(X) (sizeof((taskrow[]) { X(TASKROW) }) / sizeof(taskrow))
+
+const task tasks[] = {
+    { "and", TASKROWS(TASK_AND), { TASK_AND(TASKROW) } },
+    { "or", TASKROWS(TASK_OR), { TASK_OR(TASKROW) } },
+    { "nand", TASKROWS(TASK_NAND), { TASK_NAND(TASKROW) } },
+    { "nor", TASKROWS(TASK_NOR), { TASK_NOR(TASKROW) } },
+    { "xor", TASKROWS(TASK_XOR), { TASK_XOR(TASKROW) } },
+    { "xnor", TASKROWS(TASK_XNOR), { TASK_XNOR(TASKROW) } },
+};
+
+#define NTASKS (sizeof(tasks) / sizeof(task))
+
+/* The compiled-in task as a table, for kernels that only run tables */
+const task taskfixed = { "fixed", TASKROWS(TASK), { TASK(TASKROW) } };
+
+const task* findtask(const char* name) {
+    for (u64 i = 0; i < NTASKS; ++i) {
+        if (strcmp(tasks[i].name, name) == 0) return &tasks[i];
+    }
+    return NULL;
+}
+
+/* Load a task from a text file. One row per line: "a b t y", where a, b
+ * and t are 0 or 1 and y is 0, 1 or x. '#' starts a comment. */
+task* loadtask(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    task* out = (task*) calloc(1, sizeof(task));
+    if (out == NULL) {
+        printf("Failed to alloc task.\n");
+        exit(-1);
+    }
+    out->name = path;
+
+    char line[256];
+    u64 lnum = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lnum++;
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+
+        unsigned a, b, t;
+        char y;
+        int got = sscanf(line, " %u %u %u %c", &a, &b, &t, &y);
+        if (got <= 0) continue;
+        if (got != 4 || a > 1 || b > 1 || t > 1 || (y != '0' && y != '1' && y != 'x')) {
+            printf("%s:%lu: bad task row\n", path, lnum);
+            exit(-1);
+        }
+        if (out->nrows == MAXROWS) {
+            printf("%s: more than %d rows\n", path, MAXROWS);
+            exit(-1);
+        }
+
+        taskrow* r = &out->rows[out->nrows++];
+        r->a = a;
+        r->b = b;
+        r->t = t;
+        r->y = (y == 'x') ? YX : (y - '0');
+    }
+    fclose(f);
+
+    if (out->nrows == 0) {
+        printf("%s: no task rows\n", path);
+        exit(-1);
+    }
+
+    return out;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "types.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Per-generation telemetry.
+ *
+ * main fills one genrec per generation and hands it to telpush(). Records
+ * go through a single-producer, single-consumer ring to a writer thread,
+ * which appends them to a binary file; the evolution loop never touches
+ * the file. If the ring is full, the producer yields until the writer
+ * catches up, so no record is ever dropped.
+ *
+ * File layout, native endian:
+ *
+ *   u64 magic, u64 version, u64 ncols
+ *   ncols column names, TELNAMESZ bytes each, NUL padded
+ *   ncols column types, one byte each: 'u' for u64, 'f' for f64
+ *   records of ncols 8-byte words, in generation order
+ *
+ * The types and names come from TELCOLS, which must list the genrec fields
+ * in order. */
+
+#define TELMAGIC (0x31304d4c544f5645LU)
+#define TELVERSION (1)
+#define TELNAMESZ (16)
+
+/* Records in flight. A power of two. */
+#define TELRING (1024)
+
+/* Idle wait of the writer, in nanoseconds */
+#define TELIDLE (1000000)
+
+typedef struct {
+    u64 iter;
+    u64 alive;
+    u64 deaths;
+    u64 borna;
+    u64 borns;
+    u64 mutants;
+    u64 generated;
+    u64 best;
+    u64 worst;
+    f64 avglvng;
+    f64 avgenrg;
+    f64 runcost;
+    u64 youngest;
+    u64 oldest;
+    u64 maxzers;
+    f64 hits;
+    u64 censored;
+    u64 rolled;
+    u64 screened;
+} genrec;
+
+#define TELCOLS(X) \
+    X(iter, 'u') X(alive, 'u') X(deaths, 'u') X(borna, 'u') X(borns, 'u') \
+    X(mutants, 'u') X(generated, 'u') X(best, 'u') X(worst, 'u') \
+    X(avglvng, 'f') X(avgenrg, 'f') X(runcost, 'f') X(youngest, 'u') \
+    X(oldest, 'u') X(maxzers, 'u') X(hits, 'f') X(censored, 'u') \
+    X(rolled, 'u') X(screened, 'u')
+
+typedef struct {
+    FILE* f;
+    pthread_t thr;
+
+    genrec ring[TELRING];
+    /* Written by the producer, read by the writer, and vice versa */
+    u64 head __attribute__((aligned(64)));
+    u64 tail __attribute__((aligned(64)));
+    int quit;
+
+    /* Producer side */
+    u64 stalls;
+} telem;
+
+static void telhead(FILE* f) {
+#define TELNAME(n, t) #n,
+#define TELTYPE(n, t) t,
+    static const char* names[] = { TELCOLS(TELNAME) };
+    static const char types[] = { TELCOLS(TELTYPE) };
+#undef TELNAME
+#undef TELTYPE
+    u64 ncols = sizeof(types);
+    if (ncols * 8 != sizeof(genrec)) {
+        printf("Telemetry columns do not match genrec.\n");
+        exit(-1);
+    }
+
+    u64 h[3] = { TELMAGIC, TELVERSION, ncols };
+    fwrite(h, sizeof(u64), 3, f);
+    for (u64 i = 0; i < ncols; ++i) {
+        char name[TELNAMESZ] = { 0 };
+        strncpy(name, names[i], TELNAMESZ - 1);
+        fwrite(name, 1, TELNAMESZ, f);
+    }
+    fwrite(types, 1, ncols, f);
+}
+
+static void* telmain(void* arg) {
+    telem* T = (telem*) arg;
+    struct timespec idle = { 0, TELIDLE };
+
+    while (1) {
+        u64 tail = T->tail;
+        u64 head = __atomic_load_n(&T->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            if (__atomic_load_n(&T->quit, __ATOMIC_ACQUIRE)) {
+                /* Nothing can be pushed after quit; one last look */
+                if (__atomic_load_n(&T->head, __ATOMIC_ACQUIRE) == tail) break;
+                continue;
+            }
+            fflush(T->f);
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        /* Drain the contiguous run up to head or the end of the ring */
+        u64 i = tail & (TELRING - 1);
+        u64 k = head - tail;
+        if (k > TELRING - i) k = TELRING - i;
+        fwrite(&T->ring[i], sizeof(genrec), k, T->f);
+        __atomic_store_n(&T->tail, tail + k, __ATOMIC_RELEASE);
+    }
+    fflush(T->f);
+    return NULL;
+}
+
+/* Start a writer on path. With append set, records go after those already
+ * in a file of the same version, which is how a resumed run continues its
+ * stream; a missing or empty file is started fresh either way. Generations
+ * run after the checkpoint and before the restart then appear twice, and
+ * the later record is the one that counts. */
+telem* inittelem(const char* path, int append) {
+    telem* out = (telem*) malloc(sizeof(telem));
+    if (out == NULL) {
+        printf("Failed to init telemetry.\n");
+        exit(-1);
+    }
+    out->f = NULL;
+    if (append) {
+        u64 h[2] = { 0, 0 };
+        FILE* f = fopen(path, "rb");
+        if (f != NULL) {
+            u64 got = fread(h, sizeof(u64), 2, f);
+            fclose(f);
+            if (got > 0 && (got != 2 || h[0] != TELMAGIC || h[1] != TELVERSION)) {
+                printf("%s is not a version %d telemetry file.\n", path, TELVERSION);
+                exit(-1);
+            }
+            if (got == 2) out->f = fopen(path, "ab");
+        }
+    }
+    if (out->f == NULL) {
+        out->f = fopen(path, "wb");
+        if (out->f != NULL) telhead(out->f);
+    }
+    if (out->f == NULL) {
+        printf("Failed to open telemetry file %s.\n", path);
+        exit(-1);
+    }
+    out->head = 0;
+    out->tail = 0;
+    out->quit = 0;
+    out->stalls = 0;
+    if (pthread_create(&out->thr, NULL, telmain, out) != 0) {
+        printf("Failed to start telemetry writer.\n");
+        exit(-1);
+    }
+    return out;
+}
+
+/* Queue one record. Only one thread may push. */
+void telpush(telem* T, const genrec* r) {
+    u64 head = T->head;
+    if (head - __atomic_load_n(&T->tail, __ATOMIC_ACQUIRE) == TELRING) {
+        T->stalls++;
+        while (head - __atomic_load_n(&T->tail, __ATOMIC_ACQUIRE) == TELRING) sched_yield();
+    }
+    T->ring[head & (TELRING - 1)] = *r;
+    __atomic_store_n(&T->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Flush every queued record, stop the writer and close the file */
+void freetelem(telem* T) {
+    __atomic_store_n(&T->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(T->thr, NULL);
+    fclose(T->f);
+    free(T);
+}
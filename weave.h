@@ -0,0 +1,277 @@
+#pragma once
+
+#include "types.h"
+#include "evq.h"
+#include "task.h"
+#include "circuit.h"
+#include <string.h>
+
+/* Interleaved simulation of several circuits on one thread.
+ *
+ * The event loop of runtask() is split into a resumable state machine with
+ * two states per event: WPOP pops the next event and prefetches the gate
+ * word and voltages it will read, WGATE evaluates the gate, pushes its two
+ * successors and prefetches the top of the queue for the next pop. The
+ * scheduler steps WEAVESLOTS circuits round-robin, so each prefetch has the
+ * other slots' steps to land in before it is used. A slot that finishes its
+ * circuit picks up the next one in the batch.
+ *
+ * Each circuit runs exactly as it would under runtask(); only the order in
+ * which independent circuits make progress changes. */
+
+#ifndef WEAVESLOTS
+#define WEAVESLOTS (4)
+#endif
+
+/* Slot states */
+#define WPOP (0)
+#define WGATE (1)
+#define WIDLE (2)
+
+typedef struct {
+    evq* h;
+    simbuf* sb;
+    circ* c;
+    u64 ci;
+    u64 seed[4];
+    u32 state;
+    u32 row;
+    u64 rep;
+    u64 want;
+    u64 bnrg;
+    u64 enrg;
+    /* Defects before the current pass, and the worst pass so far */
+    u64 d0;
+    u64 rmax;
+    /* Events of the current episode */
+    u64 nev;
+
+    /* Event popped in WPOP, evaluated in WGATE */
+    f32 t;
+    u32 ind;
+    u32 tind;
+    f32 v;
+} wslot;
+
+typedef struct {
+    wslot s[WEAVESLOTS];
+    u64 cut;
+    u64 roll;
+    /* Events simulated, over all batches */
+    u64 events;
+} weave;
+
+weave* initweave(u64 clen) {
+    weave* out = (weave*) malloc(sizeof(weave));
+    if (out == NULL) {
+        printf("Failed to init weave.\n");
+        exit(-1);
+    }
+    for (u64 k = 0; k < WEAVESLOTS; ++k) {
+        out->s[k].h = initevq();
+        out->s[k].sb = initsimbuf(clen);
+        out->s[k].state = WIDLE;
+    }
+    out->cut = NOCUT;
+    out->roll = 0;
+    out->events = 0;
+    return out;
+}
+
+void freeweave(weave* W) {
+    for (u64 k = 0; k < WEAVESLOTS; ++k) {
+        freeevq(W->s[k].h);
+        freesimbuf(W->s[k].sb);
+    }
+    free(W);
+}
+
+/* Drive row r's levels onto the input taps */
+static inline void wseed(wslot* w, const taskrow* r) {
+    u64 dmsk = ((1U << 31U) - 1U);
+    circ* c = w->c;
+    SSLOCAL;
+    SSINC(tests);
+    w->nev = 0;
+
+    /* Signals from A, B, t and P (power) */
+    f32 lvls[4] = { r->a ? HI : LO, r->b ? HI : LO, r->t ? HI : LO, HI };
+    for (u64 i = 0; i < 4; ++i) {
+        u32 o1 = (c->code[i] >> 2U) & dmsk;
+        u32 o2 = (c->code[i] >> 33U);
+        f32 d1 = calcdel(w->seed, conf.mindel, conf.maxdel, 0.f, o1);
+        f32 d2 = calcdel(w->seed, conf.mindel, conf.maxdel, 0.f, o2);
+        evqins2(w->h, 0.f + d1, o1, 0.f + d2, o2, lvls[i]);
+    }
+    evqprefetch(w->h);
+    w->state = WPOP;
+}
+
+static inline void wload(weave* W, wslot* w, circ* c, u64 ci, u64* seednoise, const task* tk) {
+    w->c = c;
+    w->ci = ci;
+    w->want = runwant(c, W->roll);
+    /* Same noise for each circ */
+    memcpy(w->seed, seednoise, sizeof(u64) * 4);
+    w->row = 0;
+    w->rep = 0;
+    c->defects = 0;
+    w->d0 = 0;
+    w->rmax = 0;
+    w->bnrg = c->energy;
+    wseed(w, &tk->rows[0]);
+}
+
+/* Close the current episode and start the next one. Returns 1 once the
+ * circuit has run all its passes; its result is then in res. */
+static inline int wnext(weave* W, wslot* w, const task* tk, i64* res) {
+    circ* c = w->c;
+    const taskrow* r = &tk->rows[w->row];
+    SSLOCAL;
+    SSADD(events, w->nev);
+    SSHIST(evhist, w->nev);
+
+    /* Must eventually 'complete' */
+    if (r->t && !(w->sb->vins[5] > 0.7f)) c->defects++;
+    resetsimbuf(w->sb);
+    evqclear(w->h);
+
+    if (++w->row < tk->nrows) {
+        wseed(w, &tk->rows[w->row]);
+        return 0;
+    }
+    w->row = 0;
+    if (w->rep == 0) w->enrg = c->energy;
+    if (c->defects - w->d0 > w->rmax) w->rmax = c->defects - w->d0;
+    w->d0 = c->defects;
+    if (++w->rep < w->want && !runabort(c->defects, w->rep, w->rmax, W->cut)) {
+        wseed(w, &tk->rows[0]);
+        return 0;
+    }
+
+    runscore(c, w->rep, W->roll);
+    res[w->ci] = runend(c, w->bnrg, w->enrg);
+    w->state = WIDLE;
+    return 1;
+}
+
+/* Advance a slot by one state. Returns 1 when its circuit is done. */
+static inline int wstep(weave* W, wslot* w, const task* tk, i64* res) {
+    u64 dmsk = ((1U << 31U) - 1U);
+    circ* c = w->c;
+    simbuf* sb = w->sb;
+    SSLOCAL;
+
+    if (w->state == WPOP) {
+        if (evqrem(w->h, &w->t, &w->ind, &w->v) != 0) return wnext(W, w, tk, res);
+        if (c->energy > 0) {
+            c->energy--;
+        } else {
+            SSINC(starved);
+            return wnext(W, w, tk, res);
+        }
+        W->events++;
+        w->nev++;
+
+        w->ind %= (c->clen * 2);
+        u32 tind = w->ind % c->clen;
+
+        if (tind < 4) {
+            /* Patch in */
+            tind += 4;
+        }
+        if (tind < 6) {
+            /* Output nodes. */
+            const taskrow* r = &tk->rows[w->row];
+            SSINC(outhits);
+            setv(sb, tind, w->v);
+            if (r->t) {
+                if (r->y != YX && sb->vins[5] > 0.7f && (sb->vins[4] > 0.7f) != r->y) {
+                    c->defects += GLITCHW;
+                }
+            } else if (sb->vins[5] > 0.7f) {
+                c->defects++;
+            }
+            evqprefetch(w->h);
+            return 0;
+        }
+
+        w->tind = tind;
+        __builtin_prefetch(&c->code[tind]);
+        __builtin_prefetch(&sb->vins[tind]);
+        __builtin_prefetch(&sb->vins[tind + c->clen]);
+        __builtin_prefetch(&sb->vins[w->ind], 1);
+        w->state = WGATE;
+        return 0;
+    }
+
+    setv(sb, w->ind, w->v);
+
+    u64 g = c->code[w->tind];
+    u32 t1 = (g >> 2U) & dmsk;
+    u32 t2 = (g >> 33U);
+    f32 out = gateout(g, sb->vins[w->tind], sb->vins[w->tind + c->clen]);
+
+    f32 d1 = calcdel(w->seed, conf.mindel, conf.maxdel, w->t, t1 ^ w->ind);
+    f32 d2 = calcdel(w->seed, conf.mindel, conf.maxdel, w->t, t2 ^ w->ind);
+    evqins2(w->h, w->t + d1, t1, w->t + d2, t2, out);
+    if (evqlen(w->h) > sb->qpeak) sb->qpeak = evqlen(w->h);
+
+    if (g & 0b10LU) {
+        SSINC(wires);
+    } else if (g & 1LU) {
+        SSINC(ptype);
+    } else {
+        SSINC(ntype);
+    }
+    SSHIST(qhist, evqlen(w->h));
+    SSMAX(qpeak, evqlen(w->h));
+    evqprefetch(w->h);
+    w->state = WPOP;
+    return 0;
+}
+
+/* Skip from cs[next] to the next circuit that needs simulating, scoring the
+ * ones that can never complete on the way (see circdead()) */
+static inline u64 wskip(weave* W, u64* seednoise, circ** cs, u64 next, u64 n, const task* tk, i64* res) {
+    while (next < n && circdead(cs[next], tk)) {
+        u64 tstate[4];
+        memcpy(tstate, seednoise, sizeof(u64) * 4);
+        res[next] = runtask(W->s[0].h, tstate, cs[next], W->s[0].sb, tk, W->cut, W->roll);
+        next++;
+    }
+    return next;
+}
+
+/* runtask() for cs[0..n), interleaving up to WEAVESLOTS at a time. Each
+ * circuit starts from its own copy of seednoise; res[i] receives the result
+ * for cs[i]. */
+void runweave(weave* W, u64* seednoise, circ** cs, u64 n, const task* tk, u64 cut, u64 roll, i64* res) {
+    if (tk == NULL) tk = &taskfixed;
+    W->cut = cut;
+    W->roll = roll;
+
+    u64 next = 0;
+    u64 live = 0;
+    for (u64 k = 0; k < WEAVESLOTS && (next = wskip(W, seednoise, cs, next, n, tk, res)) < n; ++k) {
+        wload(W, &W->s[k], cs[next], next, seednoise, tk);
+        next++;
+        live++;
+    }
+
+    while (live) {
+        for (u64 k = 0; k < WEAVESLOTS; ++k) {
+            wslot* w = &W->s[k];
+            if (w->state == WIDLE) continue;
+            if (wstep(W, w, tk, res)) {
+                next = wskip(W, seednoise, cs, next, n, tk, res);
+                if (next < n) {
+                    wload(W, w, cs[next], next, seednoise, tk);
+                    next++;
+                } else {
+                    live--;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include "types.h"
+#include "conf.h"
+#include "circuit.h"
+#include "pool.h"
+#include "evcache.h"
+#include "surrogate.h"
+#include "slab.h"
+#include "telemetry.h"
+#include "prof.h"
+#include "rng.h"
+
+/* One evolving population and everything a generation needs: the slab,
+ * scratch arrays, the evaluation cache, the seed and the state carried
+ * between generations (early abort cut, surrogate model). The worker pool
+ * is borrowed, so several worlds can share one.
+ *
+ * genstep() runs one generation: evaluate, compete for food, reproduce.
+ * Each phase draws from its own keyed streams (see rng.h): the evaluation
+ * noise from slot 0, each feeding from its own slot, and each slot's
+ * reproduction and regeneration from that slot's stream. The population a
+ * generation starts from is drawn from its RNGINIT streams. */
+
+/* genstep() results */
+#define GENOK (0)
+#define GENREGEN (1)
+#define GENSOLVED (2)
+
+typedef struct {
+    u64 n;
+    slab* S;
+    circ** pop;
+    circ** live;
+    i64* rcs;
+    u64* dfs;
+    evcache* ec;
+    evpool* wp;
+    const task* tk;
+
+    u64 seed;
+    u64 iters;
+    u64 cut;
+    u64 slimit;
+    surr sg;
+
+    /* Slot of the solution after GENSOLVED */
+    u64 solved;
+} world;
+
+int cmpu64(const void* a, const void* b) {
+    u64 x = *(const u64*) a;
+    u64 y = *(const u64*) b;
+    return (x > y) - (x < y);
+}
+
+int cmpfit(const void* a, const void* b) {
+    const circ* x = *(const circ**) a;
+    const circ* y = *(const circ**) b;
+    return (x->defects > y->defects) - (x->defects < y->defects);
+}
+
+/* The circuits of w in rank, best last score first */
+void rankworld(const world* w, circ** rank) {
+    memcpy(rank, w->pop, sizeof(circ*) * w->n);
+    qsort(rank, w->n, sizeof(circ*), cmpfit);
+}
+
+/* n random circuits of len + 5 nodes, seeded with seed, evaluated on wp
+ * against task tk (NULL for the compiled-in task) */
+world* initworld(u64 n, u64 len, u64 seed, evpool* wp, const task* tk) {
+    world* out = (world*) malloc(sizeof(world));
+    if (out == NULL) {
+        printf("Failed to init world.\n");
+        exit(-1);
+    }
+    out->n = n;
+    out->S = initslab(n, len);
+    out->pop = out->S->ptr;
+    out->live = (circ**) malloc(sizeof(circ*) * n);
+    out->rcs = (i64*) malloc(sizeof(i64) * n);
+    out->dfs = (u64*) malloc(sizeof(u64) * n);
+    if (out->live == NULL || out->rcs == NULL || out->dfs == NULL) {
+        printf("Failed to init world.\n");
+        exit(-1);
+    }
+    out->ec = initevcache(n, len + 5);
+    out->wp = wp;
+    out->tk = tk;
+
+    out->seed = seed;
+    for (u64 i = 0; i < n; ++i) {
+        u64 rs[4];
+        rstream(rs, seed, 0, i, RNGINIT);
+        randcirc(rs, out->pop[i]);
+        out->pop[i]->energy = conf.initenerg;
+        out->pop[i]->born = 0;
+    }
+    out->iters = 0;
+    out->cut = NOCUT;
+    out->slimit = NOCUT;
+    initsurr(&out->sg);
+    out->solved = 0;
+    return out;
+}
+
+void freeworld(world* w) {
+    freeslab(w->S);
+    freeevcache(w->ec);
+    free(w->live);
+    free(w->rcs);
+    free(w->dfs);
+    free(w);
+}
+
+/* Draw k of the alive circuits in live into grp, then bubble sort the first
+ * m by defects */
+static inline __attribute__((always_inline))
+void pickgroup(circ** grp, circ** live, u64 alive, u64* rstate, u64 k, u64 m) {
+    for (u64 i = 0; i < k; ++i) {
+        grp[i] = live[ru(rstate) % alive];
+    }
+
+    u8 swapped = 0;
+    u64 sortn = m;
+    do {
+        swapped = 0;
+        for (u64 i = 1; i < sortn; ++i) {
+            if (grp[i - 1]->defects > grp[i]->defects) {
+                circ* temp = grp[i];
+                grp[i] = grp[i - 1];
+                grp[i - 1] = temp;
+                swapped = 1;
+            }
+        }
+        sortn--;
+    } while (swapped);
+}
+
+/* Feeding and reproduction groups. The default sizes get fixed loops. A
+ * reproduction group sorts only its first fdsize. */
+static void pickfeed(circ** grp, circ** live, u64 alive, u64* rstate) {
+    if (conf.fdsize == FDSIZE) {
+        pickgroup(grp, live, alive, rstate, FDSIZE, FDSIZE);
+    } else {
+        pickgroup(grp, live, alive, rstate, conf.fdsize, conf.fdsize);
+    }
+}
+
+static void pickrepr(circ** grp, circ** live, u64 alive, u64* rstate) {
+    if (conf.reprsize == REPRSIZE && conf.fdsize == FDSIZE) {
+        pickgroup(grp, live, alive, rstate, REPRSIZE, FDSIZE);
+    } else {
+        pickgroup(grp, live, alive, rstate, conf.reprsize, conf.fdsize);
+    }
+}
+
+/* Run generation w->iters and describe it in g. Returns GENSOLVED, with the
+ * generation unfinished and w->solved set, once a circuit has passed
+ * compthresh times in a row; otherwise GENREGEN if the population died out
+ * and was regenerated, else GENOK. */
+int genstep(world* w, genrec* g) {
+    circ** pop = w->pop;
+    circ** live = w->live;
+    slab* S = w->S;
+    u64 n = w->n;
+    u64 iters = w->iters;
+    int ret = GENOK;
+
+    PFSTART(PFEVAL);
+
+    /* Evaluate all circuits */
+    u64 alive = 0;
+    u64 dead = 0;
+    u64 borna = 0;
+    u64 borns = 0;
+    u64 best = UINT64_MAX;
+    u64 worst = 0;
+    f64 avglvng = 0.0;
+    f64 avglvngenerg = 0.0;
+    u64 generated = 0;
+    u64 mutants = 0;
+    u64 predead = 0;
+    f64 rncst = 0.0;
+    u64 censored = 0;
+    u64 rolled = 0;
+    u64 screened = 0;
+
+    u64 oldest = iters;
+    u64 youngest = 0;
+    u64 maxzers = 0;
+
+    for (u64 currCirc = 0; currCirc < n; ++currCirc) {
+        if (pop[currCirc]->energy == 0) predead++;
+        if (runwant(pop[currCirc], conf.rollreps) != conf.testreps) rolled++;
+    }
+
+    /* Simulate in parallel, skipping duplicate genomes, then reduce in
+     * slot order */
+    u64 noise[4];
+    rstream(noise, w->seed, iters, 0, RNGEVAL);
+    cacherun(w->ec, w->wp, pop, noise, w->tk, w->cut, conf.rollreps, w->rcs);
+
+    for (u64 currCirc = 0; currCirc < n; ++currCirc) {
+        rncst += (w->rcs[currCirc] / ((f64) n));
+        if (iters - pop[currCirc]->born > 100) {
+            /* 'Old Age' */
+            pop[currCirc]->energy /= (iters - pop[currCirc]->born) - 100;
+        }
+        if (pop[currCirc]->reps < conf.testreps) censored++;
+        /* Train on fresh, uncensored full scores */
+        if (conf.screen && pop[currCirc]->rated == conf.testreps) surrtrain(&w->sg, pop[currCirc]);
+
+        if (pop[currCirc]->energy != 0) {
+            live[alive] = pop[currCirc];
+            alive++;
+        }
+    }
+    dead = n - alive;
+
+    /* Generation stats over the parallel arrays */
+    slabgather(S);
+    u64 sumlvng = 0;
+    u64 sumlvngenerg = 0;
+    for (u64 i = 0; i < n; ++i) {
+        u64 d = S->defects[i];
+        best = (d < best) ? d : best;
+        worst = (d > worst) ? d : worst;
+    }
+    for (u64 i = 0; i < n; ++i) {
+        u64 lv = (S->energy[i] != 0) ? UINT64_MAX : 0;
+        sumlvng += S->defects[i] & lv;
+        sumlvngenerg += S->energy[i];
+        youngest = ((S->born[i] & lv) > youngest) ? (S->born[i] & lv) : youngest;
+        oldest = ((S->born[i] | ~lv) < oldest) ? (S->born[i] | ~lv) : oldest;
+        maxzers = ((S->zeros[i] & lv) > maxzers) ? (S->zeros[i] & lv) : maxzers;
+    }
+    avglvng = (f64) sumlvng;
+    avglvngenerg = (f64) sumlvngenerg;
+
+    for (u64 i = 0; i < n; ++i) {
+        if (S->zeros[i] == conf.compthresh) {
+            w->solved = i;
+            PFSTOP(PFEVAL);
+            return GENSOLVED;
+        }
+    }
+
+    if (conf.earlyabort || conf.screen) {
+        memcpy(w->dfs, S->defects, sizeof(u64) * n);
+        qsort(w->dfs, n, sizeof(u64), cmpu64);
+        /* Next generation's cut, and this one's screening limit */
+        if (conf.earlyabort) w->cut = w->dfs[(u64) (conf.abortpct * (n - 1))];
+        if (conf.screen) w->slimit = w->dfs[(u64) (conf.screenpct * (n - 1))];
+    }
+    PFSTOP(PFEVAL);
+
+    if (alive) {
+        PFSTART(PFFEED);
+        /* Competition over food */
+        for (u64 fdng = 0; fdng < conf.feedings; ++fdng) {
+            circ* fdgroup[GROUPMAX];
+            u64 rstate[4];
+            rstream(rstate, w->seed, iters, fdng, RNGFEED);
+            /* Pick random sample group, sorted by score */
+            pickfeed(fdgroup, live, alive, rstate);
+            /* Reward based on configured distribution */
+            u64 curew = conf.rew;
+            u64 curewind = 0;
+            while (curew != 0 && curewind != conf.fdmx) {
+                fdgroup[curewind]->energy += curew;
+                curew /= conf.fdrat;
+                curewind++;
+            }
+        }
+        PFSTOP(PFFEED);
+
+        PFSTART(PFREPR);
+        /* Competition over reproduction */
+        for (u64 currCirc = 0; currCirc < n; ++currCirc) {
+            u64 rstate[4];
+            rstream(rstate, w->seed, iters, currCirc, RNGREPR);
+            /* If not dead, don't try to replace. Maybe mutate. */
+            if (pop[currCirc]->energy != 0) {
+                if (rf(rstate) < conf.lmur) {
+                    mutcirc(rstate, pop[currCirc], conf.tmut, conf.bmut);
+                    mutants++;
+                    pop[currCirc]->born = iters;
+                }
+                continue;
+            }
+
+            circ* reprgroup[GROUPMAX];
+            /* Pick random sample group, its head sorted by score */
+            pickrepr(reprgroup, live, alive, rstate);
+
+            /* If top two have sufficient energy to reproduce,
+             * breed them and remove energy.
+             * TODO: If sexes are implemented, different energy costs. */
+            if (reprgroup[0]->energy >= conf.repwhen) { //  && rf(rstate) < conf.reprfreq
+                u8 sexual = 0;
+                if (rf(rstate) < conf.reprfreq && reprgroup[1]->energy >= conf.repwhen) {
+                    sexual = 1;
+                    crosscirc(rstate, pop[currCirc], reprgroup[0], reprgroup[1]);
+                    reprgroup[0]->energy -= conf.repcst;
+                    reprgroup[1]->energy -= conf.repcst;
+                    borns++;
+                } else {
+                    repcirc(pop[currCirc], reprgroup[0]);
+                    pop[currCirc]->energy = conf.initenerg;
+                    reprgroup[0]->energy -= conf.repcst;
+                    borna++;
+                }
+
+                if (rf(rstate) < conf.mur) {
+                    mutcirc(rstate, pop[currCirc], conf.tmut, conf.bmut);
+                    mutants++;
+                }
+
+                /* Resample offspring the surrogate is sure about */
+                for (u64 t = 0; conf.screen && t < conf.screentries && surrreject(&w->sg, pop[currCirc], w->slimit); ++t) {
+                    if (sexual) {
+                        crosscirc(rstate, pop[currCirc], reprgroup[0], reprgroup[1]);
+                    } else {
+                        repcirc(pop[currCirc], reprgroup[0]);
+                    }
+                    if (rf(rstate) < conf.mur) {
+                        mutcirc(rstate, pop[currCirc], conf.tmut, conf.bmut);
+                    }
+                    screened++;
+                }
+                pop[currCirc]->born = iters;
+            } else {
+                /*
+                if (alive < n / 3) {
+                    randcirc(rstate, pop[currCirc]);
+                    pop[currCirc]->energy = conf.initenerg;
+                    pop[currCirc]->born = iters;
+                    generated++;
+                }
+                */
+            }
+        }
+        PFSTOP(PFREPR);
+    } else {
+        PFSTART(PFREPR);
+        for (u64 i = 0; i < n; ++i) {
+            /* If can't reproduce, generate new */
+            u64 rstate[4];
+            rstream(rstate, w->seed, iters + 1, i, RNGINIT);
+            randcirc(rstate, pop[i]);
+            pop[i]->energy = conf.initenerg;
+            pop[i]->born = iters;
+            generated++;
+        }
+        ret = GENREGEN;
+        PFSTOP(PFREPR);
+    }
+
+    *g = (genrec) {
+        .iter = iters, .alive = alive, .deaths = dead - predead, .borna = borna,
+        .borns = borns, .mutants = mutants, .generated = generated,
+        .best = best, .worst = worst,
+        .avglvng = alive ? avglvng / ((f64) alive) : 0.0,
+        .avgenrg = alive ? avglvngenerg / ((f64) alive) : 0.0,
+        .runcost = rncst,
+        .youngest = alive ? iters - youngest : 0, .oldest = alive ? iters - oldest : 0,
+        .maxzers = maxzers, .hits = w->ec->hits / ((f64) w->ec->lookups),
+        .censored = censored, .rolled = rolled, .screened = screened,
+    };
+    w->iters++;
+    return ret;
+}